@@ -0,0 +1,149 @@
+/**
+ * 缓存基准测试：对比开放寻址哈希表 (cache.c) 的各淘汰策略与原 Trie 树实现 (trie_cache.c)
+ *
+ * 用法: cache_bench [budget-KiB] [names] [lookups] [scan-percent]
+ * 先插入 names 个随机域名 (超过内存预算时触发淘汰)，再按 Zipf 近似分布查询 lookups 次；
+ * Trie 树按条目数限制容量，取 LRU 哈希表在同一预算下容纳的条目数。
+ * 之后再跑一轮混入 scan-percent% 一次性随机域名的查询，模拟随机子域名扫描对命中率的影响。
+ */
+#include "cache.h"
+#include "trie_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NAME_MAXLEN 64
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 生成形如 abcdefgh.example.com#1 的随机缓存键
+ */
+static void make_names(char (*names)[NAME_MAXLEN], int n) {
+    static const char* suffixes[] = {"com", "net", "org", "cn", "io"};
+    for (int i = 0; i < n; ++i) {
+        char label[32];
+        int len = 4 + next_rand() % 16;
+        for (int j = 0; j < len; ++j) {
+            label[j] = "abcdefghijklmnopqrstuvwxyz0123456789-"[next_rand() % 37];
+        }
+        label[len] = '\0';
+        snprintf(names[i], NAME_MAXLEN, "%s.example%d.%s#%d", label, (int)(next_rand() % 100),
+                 suffixes[next_rand() % 5], next_rand() % 4 ? 1 : 28);
+    }
+}
+
+/**
+ * @brief 生成查询序列，约80%的查询落在前20%的域名上
+ *
+ * @param scan_percent 一次性域名所占百分比，这些查询依次使用下标 nnames 之后的域名
+ */
+static int* make_lookups(int nnames, int nlookups, int scan_percent) {
+    int* seq = (int*)malloc(sizeof(int) * nlookups);
+    int hot = nnames / 5 > 0 ? nnames / 5 : 1;
+    int scanned = 0;
+    for (int i = 0; i < nlookups; ++i) {
+        if ((int)(next_rand() % 100) < scan_percent) {
+            seq[i] = nnames + scanned++;
+        } else {
+            seq[i] = next_rand() % 10 < 8 ? (int)(next_rand() % hot) : (int)(next_rand() % nnames);
+        }
+    }
+    return seq;
+}
+
+static void print_result(const char* impl, double t0, double t1, double t2, int nnames, int nlookups, int hits,
+                         int entries, size_t memory) {
+    printf("%-8s %14.1f %14.1f %9.2f%% %9d %12zu\n", impl, (t1 - t0) * 1e9 / nnames, (t2 - t1) * 1e9 / nlookups,
+           hits * 100.0 / nlookups, entries, memory);
+}
+
+// 返回结束时缓存中的条目数
+static int bench_cache(cache_policy_e policy, const char* impl, char (*names)[NAME_MAXLEN], int nnames,
+                       const int* seq, int nlookups, size_t budget) {
+    uint32_t value = 0x0100007f;
+    cache_t* cache = cache_create(budget, policy);
+    double t0 = now_sec();
+    for (int i = 0; i < nnames; ++i) cache_insert(cache, names[i], &value, sizeof(value), 0);
+    double t1 = now_sec();
+    int hits = 0;
+    for (int i = 0; i < nlookups; ++i) {
+        const char* name = names[seq[i]];
+        if (cache_get(cache, name, NULL, NULL) != NULL) ++hits;
+        else cache_insert(cache, name, &value, sizeof(value), 0);
+    }
+    double t2 = now_sec();
+    cache_stats_t stats;
+    cache_get_stats(cache, &stats);
+    print_result(impl, t0, t1, t2, nnames, nlookups, hits, stats.size, stats.memory);
+    cache_destroy(cache);
+    return stats.size;
+}
+
+static void bench_trie(char (*names)[NAME_MAXLEN], int nnames, const int* seq, int nlookups, int capacity) {
+    uint32_t value = 0x0100007f;
+    trie_cache_t* trie = trie_cache_create(capacity);
+    double t0 = now_sec();
+    for (int i = 0; i < nnames; ++i) trie_cache_insert(trie, names[i], &value, sizeof(value), 0);
+    double t1 = now_sec();
+    int hits = 0;
+    for (int i = 0; i < nlookups; ++i) {
+        const char* name = names[seq[i]];
+        if (trie_cache_get(trie, name, NULL, NULL) != NULL) ++hits;
+        else trie_cache_insert(trie, name, &value, sizeof(value), 0);
+    }
+    double t2 = now_sec();
+    print_result("trie", t0, t1, t2, nnames, nlookups, hits, capacity, 0);
+    trie_cache_destroy(trie);
+}
+
+static void run_workload(char (*names)[NAME_MAXLEN], int nnames, const int* seq, int nlookups, size_t budget) {
+    printf("%-8s %14s %14s %10s %9s %12s\n", "impl", "insert ns/op", "lookup ns/op", "hit rate", "entries", "memory");
+    int capacity = bench_cache(CACHE_POLICY_LRU, "lru", names, nnames, seq, nlookups, budget);
+    bench_cache(CACHE_POLICY_TINYLFU, "tinylfu", names, nnames, seq, nlookups, budget);
+    bench_trie(names, nnames, seq, nlookups, capacity);
+}
+
+int main(int argc, char** argv) {
+    size_t budget = (size_t)(argc > 1 ? atoi(argv[1]) : 1024) << 10;
+    int nnames = argc > 2 ? atoi(argv[2]) : 100000;
+    int nlookups = argc > 3 ? atoi(argv[3]) : 5000000;
+    int scan_percent = argc > 4 ? atoi(argv[4]) : 20;
+    if (scan_percent < 0) scan_percent = 0;
+    if (scan_percent > 100) scan_percent = 100;
+    int* seq = make_lookups(nnames, nlookups, 0);
+    int* scan_seq = make_lookups(nnames, nlookups, scan_percent);
+    // 一次性域名最多需要 nlookups 个
+    int nscan = 0;
+    for (int i = 0; i < nlookups; ++i) {
+        if (scan_seq[i] >= nnames) ++nscan;
+    }
+    char (*names)[NAME_MAXLEN] = malloc(sizeof(*names) * (nnames + nscan));
+    make_names(names, nnames + nscan);
+
+    printf("budget=%zuKiB names=%d lookups=%d\n", budget >> 10, nnames, nlookups);
+    printf("\n[zipf]\n");
+    run_workload(names, nnames, seq, nlookups, budget);
+    printf("\n[zipf + %d%% scan]\n", scan_percent);
+    run_workload(names, nnames, scan_seq, nlookups, budget);
+    printf("\ntrie node bytes allocated: %zu\n", trie_cache_node_bytes);
+
+    free(scan_seq);
+    free(seq);
+    free(names);
+    return 0;
+}
@@ -0,0 +1,201 @@
+/**
+ * 报文解析基准测试：对比 dns_unpack (每个问题和记录分配 dns_rr_t 并解码域名) 与 dns_view_parse (只记录偏移)
+ *
+ * 用法: parse_bench [packets] [rounds]
+ * 生成 packets 个随机域名的查询和应答报文，应答含一条 CNAME 和四条 A 记录，域名使用压缩指针。
+ * query 一行模拟服务器收到查询后的处理：旧实现还要像 on_dns_query 那样复制一份问题数组，
+ * 新实现只把第一个问题的域名解码到栈上；response 一行遍历应答中的所有记录。
+ * 结果为单核的每个报文耗时和每秒报文数。
+ */
+#include "dns.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PACKET_MAXLEN 512
+
+typedef struct packet_t {
+    char data[PACKET_MAXLEN];
+    int len;
+} packet_t;
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put16(char* p, uint16_t v) {
+    v = htons(v);
+    memcpy(p, &v, 2);
+}
+
+static void put32(char* p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, 4);
+}
+
+// 追加一条记录的类型、类、TTL 和数据，返回新的长度
+static int put_rr(char* p, int off, uint16_t rtype, const void* data, uint16_t datalen) {
+    put16(p + off, rtype);
+    put16(p + off + 2, DNS_CLASS_IN);
+    put32(p + off + 4, 300);
+    put16(p + off + 8, datalen);
+    memcpy(p + off + 10, data, datalen);
+    return off + 10 + datalen;
+}
+
+/**
+ * @brief 生成形如 abcdefgh.example12.com 的查询和对应的应答
+ */
+static void make_packets(packet_t* queries, packet_t* responses, int n) {
+    static const char* suffixes[] = {"com", "net", "org", "cn", "io"};
+    for (int i = 0; i < n; ++i) {
+        char name[64];
+        char label[32];
+        int len = 4 + next_rand() % 16;
+        for (int j = 0; j < len; ++j) {
+            label[j] = "abcdefghijklmnopqrstuvwxyz0123456789"[next_rand() % 36];
+        }
+        label[len] = '\0';
+        snprintf(name, sizeof(name), "%s.example%d.%s", label, (int)(next_rand() % 100), suffixes[next_rand() % 5]);
+
+        char* p = queries[i].data;
+        memset(p, 0, sizeof(dnshdr_t));
+        put16(p, (uint16_t)i);
+        p[2] = 0x01; // rd
+        put16(p + 4, 1);
+        int off = sizeof(dnshdr_t) + dns_name_encode(name, p + sizeof(dnshdr_t));
+        put16(p + off, DNS_TYPE_A);
+        put16(p + off + 2, DNS_CLASS_IN);
+        queries[i].len = off + 4;
+
+        // 应答：问题 + CNAME (指向问题) + 四条 A 记录 (指向 CNAME 的目标)
+        p = responses[i].data;
+        memcpy(p, queries[i].data, queries[i].len);
+        p[2] = (char)0x81;
+        p[3] = (char)0x80;
+        put16(p + 6, 5);
+        off = queries[i].len;
+        p[off++] = (char)0xC0;
+        p[off++] = sizeof(dnshdr_t);
+        char target[16];
+        int target_off = off + 10;
+        int target_len = dns_name_encode("cdn.edge.net", target);
+        off = put_rr(p, off, DNS_TYPE_CNAME, target, (uint16_t)target_len);
+        for (int j = 0; j < 4; ++j) {
+            p[off++] = (char)(0xC0 | (target_off >> 8));
+            p[off++] = (char)target_off;
+            uint32_t addr = (uint32_t)next_rand();
+            off = put_rr(p, off, DNS_TYPE_A, &addr, 4);
+        }
+        responses[i].len = off;
+    }
+}
+
+static void print_result(const char* impl, double t0, double t1, int npackets, uint64_t checksum) {
+    double ns = (t1 - t0) * 1e9 / npackets;
+    printf("%-16s %12.1f %14.0f %12llu\n", impl, ns, 1e9 / ns, (unsigned long long)checksum);
+}
+
+// 旧的查询处理：解包，再像 on_dns_query 那样复制问题数组
+static void bench_unpack_query(const packet_t* packets, int n, int rounds) {
+    uint64_t checksum = 0;
+    double t0 = now_sec();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < n; ++i) {
+            dns_t query;
+            if (dns_unpack((char*)packets[i].data, packets[i].len, &query) < 0) abort();
+            dns_rr_t* questions = (dns_rr_t*)malloc(sizeof(dns_rr_t) * query.hdr.nquestion);
+            memcpy(questions, query.questions, sizeof(dns_rr_t) * query.hdr.nquestion);
+            checksum += questions->rtype + (uint8_t)questions->name[0];
+            free(questions);
+            dns_free(&query);
+        }
+    }
+    print_result("dns_unpack", t0, now_sec(), n * rounds, checksum);
+}
+
+static void bench_view_query(const packet_t* packets, int n, int rounds) {
+    uint64_t checksum = 0;
+    double t0 = now_sec();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < n; ++i) {
+            dns_view_t view;
+            if (dns_view_parse(packets[i].data, packets[i].len, &view) < 0) abort();
+            dns_rr_view_t question;
+            dns_view_rr(&view, view.sections[DNS_SECTION_QUESTION], 1, &question);
+            char name[DNS_NAME_MAXLEN];
+            if (dns_name_unpack(view.buf, view.len, question.name, name, sizeof(name)) < 0) abort();
+            checksum += question.rtype + (uint8_t)name[0];
+        }
+    }
+    print_result("dns_view_parse", t0, now_sec(), n * rounds, checksum);
+}
+
+static void bench_unpack_response(const packet_t* packets, int n, int rounds) {
+    uint64_t checksum = 0;
+    double t0 = now_sec();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < n; ++i) {
+            dns_t response;
+            if (dns_unpack((char*)packets[i].data, packets[i].len, &response) < 0) abort();
+            for (int j = 0; j < response.hdr.nanswer; ++j) {
+                checksum += response.answers[j].rtype + response.answers[j].datalen;
+            }
+            dns_free(&response);
+        }
+    }
+    print_result("dns_unpack", t0, now_sec(), n * rounds, checksum);
+}
+
+static void bench_view_response(const packet_t* packets, int n, int rounds) {
+    uint64_t checksum = 0;
+    double t0 = now_sec();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < n; ++i) {
+            dns_view_t view;
+            if (dns_view_parse(packets[i].data, packets[i].len, &view) < 0) abort();
+            int off = view.sections[DNS_SECTION_ANSWER];
+            for (int j = 0; j < view.hdr.nanswer; ++j) {
+                dns_rr_view_t rr;
+                off = dns_view_rr(&view, off, 0, &rr);
+                checksum += rr.rtype + rr.datalen;
+            }
+        }
+    }
+    print_result("dns_view_parse", t0, now_sec(), n * rounds, checksum);
+}
+
+int main(int argc, char** argv) {
+    int npackets = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+    if (npackets < 1) npackets = 1;
+    if (rounds < 1) rounds = 1;
+    packet_t* queries = (packet_t*)malloc(sizeof(packet_t) * npackets);
+    packet_t* responses = (packet_t*)malloc(sizeof(packet_t) * npackets);
+    make_packets(queries, responses, npackets);
+
+    printf("packets=%d rounds=%d\n", npackets, rounds);
+    printf("%-16s %12s %14s %12s\n", "impl", "ns/packet", "packets/s", "checksum");
+    printf("\n[query]\n");
+    bench_unpack_query(queries, npackets, rounds);
+    bench_view_query(queries, npackets, rounds);
+    printf("\n[response: CNAME + 4 A]\n");
+    bench_unpack_response(responses, npackets, rounds);
+    bench_view_response(responses, npackets, rounds);
+
+    free(responses);
+    free(queries);
+    return 0;
+}
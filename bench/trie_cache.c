@@ -0,0 +1,202 @@
+// 替换前基于 Trie 树和 LRU 链表的缓存实现，仅用于基准测试对比
+#include "trie_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define N 39 // 0-9, -, ., A-Z, a-z, # 共 39 个字符
+
+typedef struct lru_node_t {
+    char* key;
+    char* value;
+    int len;
+    uint64_t expire;
+    struct lru_node_t* prev;
+    struct lru_node_t* next;
+} lru_node_t;
+
+typedef struct trie_node_t {
+    struct trie_node_t* children[N];
+    lru_node_t* lru_node;
+    int is_end_of_word;
+} trie_node_t;
+
+struct trie_cache_t {
+    trie_node_t* root;
+    lru_node_t* head;
+    lru_node_t* tail;
+    int capacity;
+    int size;
+};
+
+// Helper functions for Trie and LRU
+static int char_to_index(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c == '-') return 10;
+    if (c == '.') return 11;
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 12;
+    if (c >= 'a' && c <= 'z') return c - 'a' + 12;
+    if (c == '#') return 38;
+    return -1;
+}
+
+size_t trie_cache_node_bytes = 0;
+
+static trie_node_t* create_trie_node() {
+    trie_node_t* node = (trie_node_t*)malloc(sizeof(trie_node_t));
+    trie_cache_node_bytes += sizeof(trie_node_t);
+    node->is_end_of_word = 0;
+    node->lru_node = NULL;
+    for (int i = 0; i < N; ++i) {
+        node->children[i] = NULL;
+    }
+    return node;
+}
+
+static char* dup_value(const void* value, int len) {
+    char* copy = (char*)malloc(len + 1);
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static lru_node_t* create_lru_node(const char* key, const void* value, int len, uint64_t expire) {
+    lru_node_t* node = (lru_node_t*)malloc(sizeof(lru_node_t));
+    node->key = strdup(key);
+    node->value = dup_value(value, len);
+    node->len = len;
+    node->expire = expire;
+    node->prev = NULL;
+    node->next = NULL;
+    return node;
+}
+
+// Cache functions
+trie_cache_t* trie_cache_create(int capacity) {
+    trie_cache_t* cache = (trie_cache_t*)malloc(sizeof(trie_cache_t));
+    cache->root = create_trie_node();
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->capacity = capacity;
+    cache->size = 0;
+    return cache;
+}
+
+static void free_trie_node(trie_node_t* node) {
+    for (int i = 0; i < N; ++i) {
+        if (node->children[i]) {
+            free_trie_node(node->children[i]);
+        }
+    }
+    free(node);
+}
+
+void trie_cache_destroy(trie_cache_t* cache) {
+    // 释放LRU链表中的所有节点
+    lru_node_t* current = cache->head;
+    while (current) {
+        lru_node_t* next = current->next;
+        free(current->key);
+        free(current->value);
+        free(current);
+        current = next;
+    }
+
+    // 释放Trie树中的所有节点
+    free_trie_node(cache->root);
+
+    // 释放cache结构体本身
+    free(cache);
+}
+
+void trie_cache_insert(trie_cache_t* cache, const char* key, const void* value, int len, uint64_t expire) {
+    trie_node_t* node = cache->root;
+    int length = strlen(key);
+    for (int i = 0; i < length; ++i) {
+        int index = char_to_index(key[i]);
+        if (index == -1) continue;
+        if (node->children[index] == NULL) {
+            node->children[index] = create_trie_node();
+        }
+        node = node->children[index];
+    }
+    node->is_end_of_word = 1;
+
+    if (node->lru_node) {
+        lru_node_t* existing_node = node->lru_node;
+        free(existing_node->value);
+        existing_node->value = dup_value(value, len);
+        existing_node->len = len;
+        existing_node->expire = expire;
+        if (existing_node != cache->head) {
+            if (existing_node->prev) existing_node->prev->next = existing_node->next;
+            if (existing_node->next) existing_node->next->prev = existing_node->prev;
+            if (existing_node == cache->tail) cache->tail = existing_node->prev;
+            existing_node->next = cache->head;
+            cache->head->prev = existing_node;
+            existing_node->prev = NULL;
+            cache->head = existing_node;
+        }
+        return;
+    }
+
+    lru_node_t* lru_node = create_lru_node(key, value, len, expire);
+    node->lru_node = lru_node;
+    if (cache->size == cache->capacity) {
+        lru_node_t* tail = cache->tail;
+        cache->tail = tail->prev;
+        if (cache->tail) cache->tail->next = NULL;
+        trie_node_t* del_node = cache->root;
+        int del_len = strlen(tail->key);
+        for (int i = 0; i < del_len; ++i) {
+            int index = char_to_index(tail->key[i]);
+            if (index == -1) continue;
+            del_node = del_node->children[index];
+        }
+        if (del_node) del_node->lru_node = NULL;
+        free(tail->key);
+        free(tail->value);
+        free(tail);
+        cache->size--;
+    }
+    lru_node->next = cache->head;
+    if (cache->head) cache->head->prev = lru_node;
+    cache->head = lru_node;
+    if (cache->tail == NULL) cache->tail = lru_node;
+    cache->size++;
+}
+
+const char* trie_cache_get(trie_cache_t* cache, const char* key, int* len, uint64_t* expire) {
+    trie_node_t* node = cache->root;
+    int length = strlen(key);
+    for (int i = 0; i < length; ++i) {
+        int index = char_to_index(key[i]);
+        if (index == -1) continue;
+        if (node->children[index] == NULL) {
+            return NULL;
+        }
+        node = node->children[index];
+    }
+    if (!node->is_end_of_word || !node->lru_node) {
+        return NULL;
+    }
+
+    lru_node_t* lru_node = node->lru_node;
+    if (len) *len = lru_node->len;
+    if (expire) *expire = lru_node->expire;
+    if (lru_node == cache->head) {
+        return lru_node->value;
+    }
+
+    if (lru_node->prev) lru_node->prev->next = lru_node->next;
+    if (lru_node->next) lru_node->next->prev = lru_node->prev;
+    if (lru_node == cache->tail) cache->tail = lru_node->prev;
+
+    lru_node->next = cache->head;
+    if (cache->head) cache->head->prev = lru_node;
+    cache->head = lru_node;
+    lru_node->prev = NULL;
+    if (cache->tail == NULL) cache->tail = lru_node;
+
+    return lru_node->value;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 替换前基于 Trie 树的缓存，接口与 cache.h 相同
+typedef struct trie_cache_t trie_cache_t;
+
+// 已分配的 Trie 节点总字节数，节点在淘汰时不会释放
+extern size_t trie_cache_node_bytes;
+
+trie_cache_t* trie_cache_create(int capacity);
+
+void trie_cache_destroy(trie_cache_t* cache);
+
+void trie_cache_insert(trie_cache_t* cache, const char* key, const void* value, int len, uint64_t expire);
+
+const char* trie_cache_get(trie_cache_t* cache, const char* key, int* len, uint64_t* expire);
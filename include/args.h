@@ -22,7 +22,7 @@ static struct cag_option options[] = {
                 .access_letters = "s",
                 .access_name = "server",
                 .value_name = "dns-server-ipaddr",
-                .description = "使用指定的 DNS 服务器"},
+                .description = "使用指定的 DNS 服务器，多个服务器用逗号分隔"},
 
         {.identifier = 'f',
                 .access_letters = "f",
@@ -41,11 +41,83 @@ static struct cag_option options[] = {
                 .access_name="timeout",
                 .value_name="timeout"},
 
+        {.identifier = 'e',
+                .access_letters = "e",
+                .access_name = "hedge",
+                .value_name = "percent",
+                .description = "开启对冲请求，对冲查询数不超过转发查询数的指定百分比 (默认关闭)"},
+
         {.identifier = 'c',
                 .access_letters = "c",
                 .access_name = "cache",
-                .value_name = "cache",
-                .description = "指定 Cache 最大数量 (默认为 2048)"},
+                .value_name = "size",
+                .description = "指定 Cache 的内存预算字节数 (旧版本中为条目数)，可带 K、M、G 后缀，最小为 256K (默认为 16M)"},
+
+        {.identifier = 'L',
+                .access_letters = NULL,
+                .access_name = "cache-policy",
+                .value_name = "policy",
+                .description = "缓存淘汰策略，lru 或 tinylfu (默认为 tinylfu)"},
+
+        {.identifier = 'n',
+                .access_letters = NULL,
+                .access_name = "min-ttl",
+                .value_name = "seconds",
+                .description = "缓存条目的最小 TTL (默认为 0)"},
+
+        {.identifier = 'x',
+                .access_letters = NULL,
+                .access_name = "max-ttl",
+                .value_name = "seconds",
+                .description = "缓存条目的最大 TTL (默认为 86400)"},
+
+        {.identifier = 'o',
+                .access_letters = NULL,
+                .access_name = "stale-ttl",
+                .value_name = "seconds",
+                .description = "上游无法及时应答时，可使用过期不超过指定时间的缓存条目，0 表示关闭 (默认为 86400)"},
+
+        {.identifier = 'w',
+                .access_letters = NULL,
+                .access_name = "stale-timeout",
+                .value_name = "ms",
+                .description = "等待上游应答超过指定时间后返回过期的缓存条目 (默认为 1800 ms)"},
+
+        {.identifier = 'P',
+                .access_letters = NULL,
+                .access_name = "prefetch",
+                .value_name = "percent",
+                .description = "热门缓存条目的剩余 TTL 低于指定百分比时预取，0 表示关闭 (默认为 10)"},
+
+        {.identifier = 'H',
+                .access_letters = NULL,
+                .access_name = "prefetch-hits",
+                .value_name = "hits",
+                .description = "缓存条目至少命中指定次数才会预取 (默认为 8)"},
+
+        {.identifier = 'R',
+                .access_letters = NULL,
+                .access_name = "prefetch-rate",
+                .value_name = "count",
+                .description = "每秒最多发出的预取数 (默认为 100)"},
+
+        {.identifier = 'B',
+                .access_letters = NULL,
+                .access_name = "block-mode",
+                .value_name = "mode",
+                .description = "被黑名单匹配的查询的应答方式，nxdomain、refused、sinkhole 或 nodata (默认为 nxdomain)"},
+
+        {.identifier = 'S',
+                .access_letters = NULL,
+                .access_name = "snapshot",
+                .value_name = "filename",
+                .description = "定期及退出时将缓存保存到指定的快照文件，启动时从中恢复 (默认关闭)"},
+
+        {.identifier = 'I',
+                .access_letters = NULL,
+                .access_name = "snapshot-interval",
+                .value_name = "seconds",
+                .description = "保存快照的间隔 (默认为 300)"},
 
         {
                 .identifier = 'h',
@@ -54,12 +126,25 @@ static struct cag_option options[] = {
                 .description = "显示本帮助信息，然后退出"}
 };
 
+// 最多可指定的上游 DNS 服务器数量
+#define MAX_DNS_SERVERS 8
+
 /**
  * dns-relay 的命令行参数信息
  */
 struct Config {
-    int debug_level, port, cache_size, rto;
-    const char *dns_server_ipaddr;
+    int debug_level, port, rto;
+    size_t cache_size;
+    const char *cache_policy;
+    const char *block_mode;
+    int hedge_percent;
+    int min_ttl, max_ttl;
+    int stale_ttl, stale_timeout;
+    int prefetch, prefetch_hits, prefetch_rate;
+    int snapshot_interval;
+    const char *snapshot;
+    const char *dns_servers[MAX_DNS_SERVERS];
+    int dns_server_count;
     const char *filename;
 };
 
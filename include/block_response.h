@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include "dns.h"
+
+// 被黑名单匹配的查询的应答方式
+typedef enum {
+    BLOCK_MODE_NXDOMAIN,    // 域名不存在 (rcode 3)
+    BLOCK_MODE_REFUSED,     // 拒绝 (rcode 5)
+    BLOCK_MODE_SINKHOLE,    // A 查询应答 0.0.0.0，AAAA 查询应答 ::，其他类型为 NODATA
+    BLOCK_MODE_NODATA,      // 域名存在但没有记录 (rcode 0，没有应答记录)
+} block_mode_e;
+
+// 按名称 (nxdomain、refused、sinkhole、nodata) 查找应答方式，未知名称返回-1
+int block_mode_from_name(const char* name);
+
+// 应答方式的名称
+const char* block_mode_name(block_mode_e mode);
+
+// 预先构造好的报头标志和应答记录，初始化后只读
+typedef struct block_response_t {
+    block_mode_e mode;
+    dnshdr_t    hdr;            // 报头模板，应答时只复制客户端的事务ID和 opcode、rd、cd 标志
+    uint8_t     a[16];          // 0.0.0.0 记录，名称为指向问题的压缩指针
+    uint8_t     aaaa[28];       // :: 记录
+} block_response_t;
+
+// 按应答方式构造模板，ttl 为 sinkhole 记录的 TTL (s)
+void block_response_init(block_response_t* block, block_mode_e mode, uint32_t ttl);
+
+/**
+ * @brief 由客户端查询构造拦截应答
+ *
+ * 只复制客户端的报头和问题，再按模板改写标志、追加预先打包的记录，不分配堆内存。
+ *
+ * @param block 应答模板
+ * @param query 客户端的原始查询报文
+ * @param qlen 问题部分长度
+ * @param rtype 查询类型
+ * @param rclass 查询类
+ * @param buf 输出的缓冲区，至少512字节
+ * @return 应答长度
+ */
+int block_response_build(const block_response_t* block, const char* query, int qlen,
+                         uint16_t rtype, uint16_t rclass, char* buf);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 只读的黑名单，按反转后的标签 (com -> example -> ads) 组织成紧凑的 Trie 树
+// 构建完成后不再修改，查询不改写任何状态，可被多个线程同时查询
+typedef struct blocklist_s blocklist_t;
+
+// 黑名单构建器，收集域名后一次性构建
+typedef struct blocklist_builder_s blocklist_builder_t;
+
+// 创建构建器
+blocklist_builder_t* blocklist_builder_create(void);
+
+/**
+ * @brief 添加一条规则，不区分大小写，域名可带末尾的点
+ *
+ * 支持三种写法：
+ *   example.com        只匹配 example.com
+ *   *.example.com      匹配 example.com 的所有子域名，不匹配 example.com 本身
+ *   ||example.com^     匹配 example.com 及其所有子域名
+ *
+ * @return 成功时返回0，规则不合法时返回-1
+ */
+int blocklist_builder_add(blocklist_builder_t* builder, const char* rule);
+
+// 放弃构建，释放构建器
+void blocklist_builder_free(blocklist_builder_t* builder);
+
+// 由构建器构建黑名单，构建器随后被释放
+blocklist_t* blocklist_build(blocklist_builder_t* builder);
+
+// 对构建器中的域名排序并去重，不同的构建器可以在多个线程中同时排序
+void blocklist_builder_sort(blocklist_builder_t* builder);
+
+// 合并 n 个已排序的构建器并构建黑名单，构建器随后被释放
+blocklist_t* blocklist_build_merged(blocklist_builder_t** builders, int n);
+
+// 销毁黑名单
+void blocklist_destroy(blocklist_t* blocklist);
+
+// 黑名单的内存布局，可以原样写入文件，再从映射的文件中直接查询
+typedef struct blocklist_image_t {
+    const void* nodes;          // 节点数组，每个节点 BLOCKLIST_NODE_SIZE 字节
+    uint32_t nnodes;
+    const char* labels;         // 字符串池
+    size_t labels_len;
+    size_t count;               // 规则数
+    const void* filter;         // 布隆过滤器的位数组，filter_blocks 个 64 字节的块
+    uint32_t filter_blocks;
+    uint32_t filter_k;
+} blocklist_image_t;
+
+#define BLOCKLIST_NODE_SIZE 16
+
+// 导出黑名单的内存布局，引用黑名单自身的内存
+void blocklist_export(const blocklist_t* blocklist, blocklist_image_t* image);
+
+// 直接在给定的内存上构造黑名单，不复制节点和字符串池，内存须在黑名单销毁前保持有效
+// 会检查节点中的下标，镜像不合法时返回 NULL
+blocklist_t* blocklist_import(const blocklist_image_t* image);
+
+// blocklist_lookup 的结果
+enum {
+    BLOCKLIST_FILTERED,     // 被布隆过滤器排除，没有访问 Trie 树
+    BLOCKLIST_UNMATCHED,    // 过滤器误判，Trie 树中没有匹配的规则
+    BLOCKLIST_MATCHED,      // 被黑名单中的规则匹配
+};
+
+// 查询域名是否被黑名单中的规则匹配，不区分大小写
+// 先检查顶级域名，再用布隆过滤器从右往左检查更长的后缀 (通常只读一条缓存行)，可能匹配时才遍历 Trie 树
+int blocklist_lookup(const blocklist_t* blocklist, const char* name);
+
+// 同 blocklist_lookup，只返回是否匹配
+bool blocklist_contains(const blocklist_t* blocklist, const char* name);
+
+// 黑名单中的规则数 (去重后，||example.com^ 计为两条)
+size_t blocklist_size(const blocklist_t* blocklist);
+
+// 黑名单占用的内存，包括布隆过滤器 (字节)
+size_t blocklist_memory(const blocklist_t* blocklist);
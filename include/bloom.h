@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 分块布隆过滤器：每个键的所有位都落在同一个 64 字节的块中，查询只读一条缓存行
+// 构建后只读，可被多个线程同时查询
+typedef struct bloom_t {
+    uint64_t*   blocks;         // nblocks 个块，每块 BLOOM_BLOCK_WORDS 个 uint64_t
+    uint32_t    nblocks;
+    uint32_t    k;              // 每个键在块内设置的位数
+    bool        mapped;         // 位数组引用外部内存 (规则镜像)，释放时不释放
+} bloom_t;
+
+#define BLOOM_BLOCK_WORDS   8
+#define BLOOM_BLOCK_SIZE    (BLOOM_BLOCK_WORDS * 8)
+
+// 按键数和每个键占用的位数分配过滤器，nkeys 为0时得到空过滤器 (所有查询都返回 false)
+void bloom_init(bloom_t* bloom, size_t nkeys, int bits_per_key);
+
+// 加入一个键的64位哈希值
+void bloom_add(bloom_t* bloom, uint64_t hash);
+
+// 键可能存在时返回 true；返回 false 时键一定不存在
+bool bloom_may_contain(const bloom_t* bloom, uint64_t hash);
+
+// 位数组占用的内存 (字节)
+size_t bloom_memory(const bloom_t* bloom);
+
+// 释放位数组
+void bloom_free(bloom_t* bloom);
+
+// 64位 FNV-1a，可以分段计算：把上一段的结果作为下一段的 hash 传入
+#define BLOOM_HASH_INIT     14695981039346656037ull
+#define BLOOM_HASH_PRIME    1099511628211ull
+uint64_t bloom_hash(uint64_t hash, const char* data, size_t len);
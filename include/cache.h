@@ -1,18 +1,77 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 // 定义缓存结构
 typedef struct cache_t cache_t;
 
-// 创建缓存
-cache_t* cache_create(int capacity);
+// 淘汰策略
+typedef enum {
+    CACHE_POLICY_LRU,       // 严格 LRU，命中时移动链表节点
+    CACHE_POLICY_TINYLFU,   // W-TinyLFU：窗口区 + 主区 CLOCK，Count-Min Sketch 频率准入，命中时只设置访问位
+} cache_policy_e;
+
+// 缓存统计
+typedef struct cache_stats_t {
+    const char* policy;     // 淘汰策略名称
+    uint64_t hits;          // cache_get 命中数 (包括已过期的条目)
+    uint64_t misses;        // cache_get 未命中数
+    uint64_t evictions;     // 因容量不足淘汰的条目数
+    uint64_t rejected;      // 其中未被准入主区的新条目数
+    int size;               // 条目数
+    int capacity;           // 条目数上限，由哈希表大小决定
+    size_t budget;          // 内存预算 (字节)
+    size_t used;            // 条目占用的块的总大小 (字节)
+    size_t memory;          // 缓存实际占用的内存，包括哈希表、计数器和已驻留的 slab 页 (字节)
+} cache_stats_t;
+
+// 由名称 (lru、tinylfu) 得到淘汰策略，未知名称返回-1
+int cache_policy_from_name(const char* name);
+
+// 内存预算的下限 (字节)，更小的预算按下限处理
+#define CACHE_MIN_BUDGET    (256 * 1024)
+
+// 创建缓存，budget 为内存预算 (字节)，哈希表等固定开销也计入其中
+// 条目从按大小分类的 slab 页中分配，内存不足时按淘汰策略淘汰条目
+cache_t* cache_create(size_t budget, cache_policy_e policy);
 
 // 销毁缓存
 void cache_destroy(cache_t* cache);
 
-// 插入缓存
-void cache_insert(cache_t* cache, const char* key, const char* value);
+// 插入缓存，value 为任意二进制数据，expire 为绝对过期时间 (ms)，0 表示永不过期
+// 键和值合计超过一个 slab 页 (16 KiB) 的条目不会被缓存
+void cache_insert(cache_t* cache, const char* key, const void* value, int len, uint64_t expire);
+
+// 从缓存获取，len 和 expire 可为 NULL；过期的条目仍会返回，由调用者根据 expire 判断
+// 调用者可以原地修改返回的值 (例如其中的统计字段)，但不能改变其长度
+char* cache_get(cache_t* cache, const char* key, int* len, uint64_t* expire);
+
+// 获取缓存统计
+void cache_get_stats(cache_t* cache, cache_stats_t* stats);
+
+// 序列化后的快照，不再引用缓存，可以交给其他线程写入文件
+typedef struct cache_snapshot_t {
+    char* data;
+    size_t len;
+    int count;              // 条目数
+} cache_snapshot_t;
+
+// 将缓存序列化到内存中，只复制条目，不进行文件 I/O；now 为当前时间 (ms)，永不过期的条目不保存
+// 成功时返回0，失败时返回-1
+int cache_snapshot(cache_t* cache, uint64_t now, cache_snapshot_t* snapshot);
+
+// 将序列化后的快照写入文件 (先写临时文件再重命名)，可在任意线程中调用
+// 成功时返回保存的条目数，失败时返回-1
+int cache_snapshot_write(const cache_snapshot_t* snapshot, const char* filename);
+
+// 释放序列化后的快照
+void cache_snapshot_free(cache_snapshot_t* snapshot);
+
+// 序列化并写入快照文件，相当于依次调用以上三个函数
+// 成功时返回保存的条目数，失败时返回-1
+int cache_save(cache_t* cache, const char* filename, uint64_t now);
 
-// 从缓存获取
-const char* cache_get(cache_t* cache, const char* key);
+// 通过 mmap 加载快照文件，按停机时长修正过期时间，过期时间早于 min_expire 的条目被丢弃
+// 校验和不符的快照整体丢弃；成功时返回加载的条目数，失败时返回-1
+int cache_load(cache_t* cache, const char* filename, uint64_t now, uint64_t min_expire);
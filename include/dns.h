@@ -22,12 +22,15 @@
 #define DNS_TYPE_PTR    12  // 指针记录
 #define DNS_TYPE_HINFO  13  // 主机信息
 #define DNS_TYPE_MX     15  // 邮件交换记录
+#define DNS_TYPE_TXT    16  // 文本记录
 #define DNS_TYPE_AAAA   28  // IPv6地址
+#define DNS_TYPE_OPT    41  // EDNS(0) 伪记录，只出现在附加部分
 #define DNS_TYPE_AXFR   252 // 区域传送
 #define DNS_TYPE_ANY    255 // 任意记录类型
 
 // 定义DNS类
 #define DNS_CLASS_IN    1   // 互联网
+#define DNS_CLASS_CH    3   // Chaos，用于查询服务器自身信息
 
 // 定义DNS名称的最大长度
 #define DNS_NAME_MAXLEN 256
@@ -88,6 +91,43 @@ typedef struct dns_s {
     dns_rr_t*       addtionals;   // 附加记录
 } dns_t;
 
+// 名称压缩表的容量，写满后新的后缀不再作为压缩目标
+#define DNS_COMPRESS_MAX 64
+
+// 名称压缩表：同一报文中已写出的域名后缀及其偏移 (RFC 1035 4.1.4)
+typedef struct dns_compress_s {
+    int         n;
+    const char* names[DNS_COMPRESS_MAX];    // 后缀，指向正在打包的记录的 name，例如 example.com
+    uint16_t    offs[DNS_COMPRESS_MAX];     // 后缀在报文中的偏移
+} dns_compress_t;
+
+// 报文的各个部分
+enum {
+    DNS_SECTION_QUESTION,
+    DNS_SECTION_ANSWER,
+    DNS_SECTION_AUTHORITY,
+    DNS_SECTION_ADDITIONAL,
+    DNS_SECTION_END,
+};
+
+// 报文的只读视图：只记录各部分在原始报文中的偏移，不复制、不解码域名
+typedef struct dns_view_s {
+    const char* buf;            // 原始报文，视图使用期间必须有效
+    int         len;
+    dnshdr_t    hdr;            // 报头，事务ID和计数为主机字节序
+    int         sections[DNS_SECTION_END + 1];  // 各部分的起始偏移，最后一项为最后一条记录之后的偏移
+} dns_view_t;
+
+// 一条问题或资源记录的视图
+typedef struct dns_rr_view_s {
+    int         name;           // 域名的偏移，可能含有压缩指针，用 dns_name_unpack 解码
+    uint16_t    rtype;
+    uint16_t    rclass;
+    uint32_t    ttl;            // 问题为0
+    uint16_t    datalen;        // 问题为0
+    int         data;           // 数据的偏移，问题为0
+} dns_rr_view_t;
+
 BEGIN_EXTERN_C
 
 /**
@@ -115,32 +155,38 @@ int dns_name_decode(const char* buf, char* domain);
 /**
  * @brief 打包DNS资源记录
  *
- * 将DNS资源记录打包成二进制格式，以便发送。
+ * 将DNS资源记录打包成二进制格式写入报文的 off 处，以便发送。
+ * 域名的后缀已在报文中出现过时写为指向它的压缩指针，并把新写出的后缀加入压缩表。
+ * 数据原样写入，其中的域名不压缩。
  *
  * @param rr 输入的DNS资源记录
- * @param buf 输出的缓冲区
+ * @param buf 报文
  * @param len 缓冲区长度
+ * @param off 写入的偏移
+ * @param comp 名称压缩表，为 NULL 时不压缩
  * @return 成功时返回打包后的长度
  */
-int dns_rr_pack(dns_rr_t* rr, char* buf, int len);
+int dns_rr_pack(dns_rr_t* rr, char* buf, int len, int off, dns_compress_t* comp);
 
 /**
  * @brief 解包DNS资源记录
  *
- * 将二进制格式的资源记录解包成结构化格式，以便处理。
+ * 将报文 off 处的资源记录解包成结构化格式，以便处理。域名中的压缩指针只能指向之前的位置，
+ * 因此跟随指针一定会终止；数据原样引用报文，其中的压缩指针相对于报文起始。
  *
- * @param buf 输入的缓冲区
- * @param len 缓冲区长度
+ * @param buf 报文
+ * @param len 报文长度
+ * @param off 记录的偏移
  * @param rr 输出的DNS资源记录
  * @param is_question 是否是查询
- * @return 成功时返回解包后的长度
+ * @return 成功时返回记录的长度
  */
-int dns_rr_unpack(char* buf, int len, dns_rr_t* rr, int is_question);
+int dns_rr_unpack(char* buf, int len, int off, dns_rr_t* rr, int is_question);
 
 /**
  * @brief 打包DNS消息
  *
- * 将整个DNS消息打包，包括报头和所有资源记录。
+ * 将整个DNS消息打包，包括报头和所有资源记录，所有记录的域名共用一个名称压缩表。
  *
  * @param dns 输入的DNS消息
  * @param buf 输出的缓冲区
@@ -161,6 +207,56 @@ int dns_pack(dns_t* dns, char* buf, int len);
  */
 int dns_unpack(char* buf, int len, dns_t* dns);
 
+/**
+ * @brief 计算报文中第一个问题的长度
+ *
+ * 问题从报头之后开始，域名中不允许出现压缩指针。
+ *
+ * @param buf 输入的缓冲区
+ * @param len 缓冲区长度
+ * @return 成功时返回问题部分长度，报文不完整或域名不合法 (与 dns_view_parse 的规则相同) 时返回-1
+ */
+int dns_question_len(const char* buf, int len);
+
+/**
+ * @brief 建立报文的视图
+ *
+ * 一次遍历校验报头和所有记录：标签长度、压缩指针 (只能指向之前的位置) 和数据长度都不越界。
+ * 不分配内存，不解码域名；报文末尾多余的字节忽略。
+ *
+ * @param buf 输入的缓冲区
+ * @param len 缓冲区长度
+ * @param view 输出的视图
+ * @return 成功时返回最后一条记录之后的偏移，报文不合法时返回-1
+ */
+int dns_view_parse(const char* buf, int len, dns_view_t* view);
+
+/**
+ * @brief 读取视图中的一条问题或资源记录
+ *
+ * @param view 报文视图
+ * @param off 记录的起始偏移，例如 view->sections[DNS_SECTION_ANSWER]
+ * @param is_question 是否是问题
+ * @param rr 输出的记录视图
+ * @return 下一条记录的偏移
+ */
+int dns_view_rr(const dns_view_t* view, int off, int is_question, dns_rr_view_t* rr);
+
+/**
+ * @brief 解码报文中的域名，跟随压缩指针
+ *
+ * 标签中的 '.'、'\\' 和不可打印的字节按 RFC 1035 5.1 转义 (\\.、\\\\、\\DDD)，不同的域名解码结果一定不同。
+ * dns_rr_pack 打包时还原转义。
+ *
+ * @param buf 报文
+ * @param len 报文长度
+ * @param off 域名的偏移
+ * @param name 输出的域名，例如 www.example.com，根域为空字符串
+ * @param size name 的大小
+ * @return 成功时返回域名的长度，域名不合法或转义后超出 size 时返回-1
+ */
+int dns_name_unpack(const char* buf, int len, int off, char* name, int size);
+
 /**
  * @brief 释放DNS消息中分配的资源记录
  *
@@ -206,21 +302,5 @@ int nslookup(const char* domain, uint32_t* addrs, int naddr, const char* nameser
  */
 int nslookup6(const char* domain, uint8_t addrs[][16], int naddr, const char* nameserver);
 
-/**
- * @brief 异步发送DNS查询并接收响应
- *
- * @param query 输入的DNS查询消息
- * @param response 输出的DNS响应消息
- * @param nameserver DNS服务器地址
- * @param io 传入的hio对象
- * @param cb 查询完成后的回调函数
- * @return 成功时返回0
- */
-int dns_query_async(dns_t* query, dns_t* response, const char* nameserver, hio_t* io,
-
-                    void (*cb)(hio_t *, void *, int)
-
-);
-
 
 END_EXTERN_C
\ No newline at end of file
@@ -8,16 +8,77 @@
 #include "args.h"
 #include "logger.h"
 #include "cache.h"
+#include "blocklist.h"
+#include "rules_image.h"
+#include "local_zone.h"
+#include "block_response.h"
+#include "forwarder.h"
+
+// 在途查询哈希表的桶数
+#define DNS_FLIGHT_BUCKETS 1024
+
+// 问题相同的客户端请求合并后的一次在途上游查询
+typedef struct dns_flight_s dns_flight_t;
+
+// 在后台线程中进行的一次规则文件重新加载
+typedef struct dns_reload_s dns_reload_t;
+
+// 在后台线程中进行的一次快照写入
+typedef struct dns_snapshot_s dns_snapshot_t;
+
+// 由规则文件生成的只读数据，重新加载时整体替换
+typedef struct {
+    blocklist_t* blacklist;     // 黑名单
+    local_zone_t* local;        // 本地区域，在缓存之前查询，条目不会被淘汰
+    rules_image_t* image;       // 从规则镜像加载时为映射的镜像，黑名单引用其中的内存
+} dns_rules_t;
+
+// 服务器运行统计
+typedef struct {
+    uint64_t queries;       // 收到的查询数
+    uint64_t local_hits;    // 由本地区域应答的查询数
+    uint64_t cache_hits;    // 缓存命中数
+    uint64_t negative_hits; // 其中否定应答 (NXDOMAIN/NODATA) 的命中数
+    uint64_t stale_hits;    // 上游无法及时应答时返回过期应答的次数
+    uint64_t prefetches;    // 过期前发出的预取数
+    uint64_t prefetch_saved;// 因预取而避免的未命中数
+    uint64_t forwarded;     // 实际发往上游的查询数
+    uint64_t coalesced;     // 合并到已有在途查询上的查询数
+    uint64_t filter_rejects;        // 黑名单查询中被布隆过滤器直接排除的次数
+    uint64_t filter_false_positives;// 过滤器判为可能匹配、但 Trie 树中没有匹配规则的次数
+    uint64_t blacklisted;           // 被黑名单匹配的次数
+} dns_server_stats_t;
 
 typedef struct {
     // 事件循环
     hloop_t* loop;
     // 服务器配置
     struct Config* config;
+    // 上游转发引擎
+    forwarder_t* forwarder;
     // 缓存
     cache_t* cache;
-    // 黑名单
-    cache_t* blacklist;
+    // 被黑名单匹配的查询的应答模板
+    block_response_t block;
+    // 黑名单和本地记录，只在事件循环线程中读取和替换
+    dns_rules_t* rules;
+    // 正在进行的重新加载，没有时为 NULL
+    dns_reload_t* reload;
+    // 重新加载期间又收到了重新加载请求
+    bool reload_pending;
+    // 正在后台写入的快照，没有时为 NULL
+    dns_snapshot_t* snapshot;
+    // 规则文件变化后延迟一段时间再重新加载，合并连续的写入
+    htimer_t* reload_timer;
+    // 唤醒管道，dns_server_reload 和 dns_server_shutdown 写入，事件循环读取后开始重新加载或停止
+    int reload_pipe[2];
+    // 按问题索引的在途查询
+    dns_flight_t* flights[DNS_FLIGHT_BUCKETS];
+    // 运行统计
+    dns_server_stats_t stats;
+    // 预取限速，当前一秒窗口的起始时间和已发出的预取数
+    uint64_t prefetch_window;
+    int prefetch_count;
 } dns_server_t;
 
 /**
@@ -30,7 +91,7 @@ typedef struct {
 int dns_server_init(dns_server_t* server, struct Config* config);
 
 /**
- * @brief 启动DNS服务器
+ * @brief 启动DNS服务器，事件循环停止后返回
  *
  * @param server DNS服务器实例
  * @return 成功时返回0
@@ -38,7 +99,30 @@ int dns_server_init(dns_server_t* server, struct Config* config);
 int dns_server_start(dns_server_t* server);
 
 /**
- * @brief 停止DNS服务器
+ * @brief 请求重新加载规则文件
+ *
+ * 只向唤醒管道写入一个字节，可以在信号处理函数 (SIGHUP) 中调用。
+ * 新的黑名单和本地记录在后台线程中构建，完成后在事件循环中替换，期间查询照常使用旧的规则。
+ *
+ * @param server DNS服务器实例
+ * @return 成功时返回0
+ */
+int dns_server_reload(dns_server_t* server);
+
+/**
+ * @brief 请求停止事件循环，使 dns_server_start 返回
+ *
+ * 与 dns_server_reload 一样只向唤醒管道写入一个字节，可以在信号处理函数 (SIGINT) 中调用。
+ *
+ * @param server DNS服务器实例
+ * @return 成功时返回0
+ */
+int dns_server_shutdown(dns_server_t* server);
+
+/**
+ * @brief 停止DNS服务器，在 dns_server_start 返回后调用
+ *
+ * 此时事件循环已停止，保存快照后释放所有资源，包括事件循环。
  *
  * @param server DNS服务器实例
  * @return 成功时返回0
@@ -49,4 +133,4 @@ int dns_server_stop(dns_server_t* server);
 
 // 内部函数
 static void on_recv(hio_t* io, void* buf, int readbytes);
-static void on_dns_query(hio_t* io, dns_t* query, sockaddr_u* client_addr, socklen_t addrlen);
\ No newline at end of file
+static void on_dns_query(hio_t* io, const dns_view_t* query, sockaddr_u* client_addr, bool screened);
\ No newline at end of file
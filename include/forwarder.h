@@ -0,0 +1,83 @@
+#pragma once
+
+#include <hv/hexport.h>
+#include <hv/hloop.h>
+#include <hv/hsocket.h>
+#include "args.h"
+
+// 转发引擎，负责在事件循环上异步地向上游 DNS 服务器发送查询并匹配应答
+typedef struct forwarder_s forwarder_t;
+
+/**
+ * @brief 上游查询完成回调
+ *
+ * @param userdata 发起查询时传入的用户数据
+ * @param status 0 表示收到应答，ETIMEDOUT 表示超时，ECANCELED 表示转发引擎已销毁
+ * @param buf 上游应答报文，事务ID已恢复为发起查询时的值；失败时为 NULL
+ * @param len 应答报文长度
+ */
+typedef void (*forward_cb)(void* userdata, int status, char* buf, int len);
+
+// 单个上游服务器的统计信息
+typedef struct upstream_stats_s {
+    char        name[SOCKADDR_STRLEN];  // ip:port
+    bool        healthy;        // 是否可用
+    uint32_t    srtt_us;        // 平滑往返时间 (us)
+    uint32_t    rttvar_us;      // 往返时间偏差 (us)
+    uint32_t    fail_score;     // 失败分数，超时率的千分比
+    uint64_t    queries;        // 发出的查询数
+    uint64_t    answers;        // 收到的应答数
+    uint64_t    timeouts;       // 超时数
+    uint32_t    p95_us;         // 95 分位往返时间 (us)
+    uint64_t    hedged;         // 作为对冲目标收到的查询数
+    uint64_t    hedge_wins;     // 对冲查询先于原查询返回的次数
+} upstream_stats_t;
+
+BEGIN_EXTERN_C
+
+/**
+ * @brief 创建转发引擎
+ *
+ * @param loop 事件循环
+ * @param config 服务器配置，使用其中的上游服务器列表和超时时间 rto
+ * @return 成功时返回转发引擎，失败时返回 NULL
+ */
+forwarder_t* forwarder_create(hloop_t* loop, struct Config* config);
+
+/**
+ * @brief 销毁转发引擎
+ *
+ * 所有未完成的查询都会以 ECANCELED 状态回调。
+ *
+ * @param fwd 转发引擎
+ */
+void forwarder_destroy(forwarder_t* fwd);
+
+/**
+ * @brief 异步转发一个 DNS 查询
+ *
+ * 报文会被复制，并将事务ID改写为上游事务ID后立即发往当前最佳的上游，函数不会阻塞。
+ * 某个上游超过其重传超时仍未应答时转移到下一个上游，直到 config->rto 到期。
+ * 开启对冲时，首选上游超过其 p95 往返时间仍未应答，会额外向次优上游发送副本。
+ * 收到匹配的应答或超时后调用 cb，cb 保证只被调用一次。
+ *
+ * @param fwd 转发引擎
+ * @param buf 完整的 DNS 查询报文
+ * @param len 报文长度
+ * @param cb 完成回调
+ * @param userdata 传给回调的用户数据
+ * @return 成功时返回0
+ */
+int forwarder_query(forwarder_t* fwd, const char* buf, int len, forward_cb cb, void* userdata);
+
+/**
+ * @brief 获取各上游服务器的统计信息
+ *
+ * @param fwd 转发引擎
+ * @param stats 输出的统计信息数组
+ * @param nstats 数组大小
+ * @return 写入的上游数量
+ */
+int forwarder_get_stats(forwarder_t* fwd, upstream_stats_t* stats, int nstats);
+
+END_EXTERN_C
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "blocklist.h"
+
+// 规则文件中的一条本地记录
+typedef struct hosts_record_t {
+    char*       name;
+    uint16_t    type;           // DNS_TYPE_A、DNS_TYPE_AAAA 或 DNS_TYPE_CNAME
+    uint8_t     addr[16];       // A 记录为前4字节的 IPv4 地址，AAAA 记录为 IPv6 地址，网络字节序
+    char*       target;         // CNAME 记录的目标域名，其他记录为 NULL
+} hosts_record_t;
+
+// 规则文件的解析结果
+typedef struct hosts_t {
+    blocklist_t*    blacklist;  // 0.0.0.0 和 ||example.com^ 规则
+    hosts_record_t* records;    // 其他记录，按在文件中出现的顺序排列
+    int             nrecords;
+    size_t          lines;      // 文件的行数
+    size_t          bytes;      // 文件的大小 (字节)
+    int             threads;    // 解析使用的线程数
+} hosts_t;
+
+/**
+ * @brief 加载规则文件
+ *
+ * 通过 mmap 映射文件，按行边界切分为若干块，在多个线程中并行解析并各自排序黑名单，最后归并构建。
+ * 以 # 或 ! 开头的行为注释；单独一行的 ||example.com^ 加入黑名单；
+ * "0.0.0.0 域名" 加入黑名单，其他 "IPv4/IPv6 地址 域名" 作为本地记录，"域名 CNAME 目标" 为别名记录。
+ *
+ * @return 成功时返回0，无法读取文件时返回-1
+ */
+int hosts_load(const char* filename, hosts_t* hosts);
+
+// 释放解析结果中的黑名单和本地记录
+void hosts_free(hosts_t* hosts);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hosts.h"
+
+// 本地区域：规则文件中的 A、AAAA 和 CNAME 记录
+// 构建时为每个域名预先打包好各类查询的应答记录，构建后只读，条目不会被淘汰
+typedef struct local_zone_s local_zone_t;
+
+/**
+ * @brief 由规则文件中的本地记录构建本地区域
+ *
+ * 同一域名可以有多条 A 和 AAAA 记录；有 CNAME 记录时忽略该域名的其他记录，
+ * 目标也在本地区域中时，应答中附带目标的记录 (最多跟随8层)。
+ *
+ * @param records 本地记录，按在文件中出现的顺序排列
+ * @param nrecords 记录数
+ * @param ttl 应答中的 TTL (s)
+ */
+local_zone_t* local_zone_create(const hosts_record_t* records, int nrecords, uint32_t ttl);
+
+// 销毁本地区域
+void local_zone_destroy(local_zone_t* zone);
+
+// 本地区域中的域名数
+int local_zone_size(const local_zone_t* zone);
+
+/**
+ * @brief 由客户端查询构造应答
+ *
+ * 应答由客户端的报头、问题和预先打包好的记录部分拼接而成，不分配堆内存。
+ * 域名在本地区域中但没有所查类型的记录时返回 NODATA 应答，不再向上游查询。
+ *
+ * @param zone 本地区域
+ * @param query 客户端的原始查询报文
+ * @param qlen 问题部分长度
+ * @param name 问题中的域名，不区分大小写
+ * @param rtype 查询类型
+ * @param rclass 查询类
+ * @param buf 输出的缓冲区，至少512字节
+ * @return 应答长度，域名不在本地区域中或不是 IN 类时返回0
+ */
+int local_zone_answer(const local_zone_t* zone, const char* query, int qlen, const char* name,
+                      uint16_t rtype, uint16_t rclass, char* buf);
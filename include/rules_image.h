@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include "hosts.h"
+
+// 规则镜像：由 dns_relay_compile 离线编译的二进制规则文件
+// 黑名单按查询时的内存布局存放，服务器映射后直接查询，无需解析，多个进程共享同一份页缓存
+typedef struct rules_image_s rules_image_t;
+
+// 镜像格式版本，布局变化时递增，旧版本的镜像需要重新编译
+#define RULES_IMAGE_VERSION 3
+
+// 判断文件是否为规则镜像 (只检查文件头的魔数)
+bool rules_image_probe(const char* filename);
+
+// 将解析好的规则写成镜像文件 (先写临时文件再重命名，不影响正在映射旧文件的进程)
+// 成功时返回0，失败时返回-1
+int rules_image_write(const char* filename, const hosts_t* hosts);
+
+/**
+ * @brief 只读映射镜像文件，校验版本和校验和
+ *
+ * hosts 中的黑名单直接引用映射的内存，须在 rules_image_close 之前释放；本地记录为复制的数据。
+ * hosts 的 lines 和 threads 为0，bytes 为镜像大小。
+ *
+ * @return 成功时返回镜像，文件不存在或不合法时返回 NULL
+ */
+rules_image_t* rules_image_open(const char* filename, hosts_t* hosts);
+
+// 解除映射
+void rules_image_close(rules_image_t* image);
@@ -1,15 +1,59 @@
 #pragma once
 
 #include "args.h"
+#include "cache.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/**
+ * 解析逗号分隔的上游 DNS 服务器列表，追加到 config 中
+ */
+static void parse_server_list(struct Config *config, const char *value)
+{
+    // 拆分出的字符串在整个进程生命周期内有效，不释放
+    char *list = strdup(value);
+    for (char *server = strtok(list, ","); server != NULL; server = strtok(NULL, ",")) {
+        if (config->dns_server_count == MAX_DNS_SERVERS) {
+            printf("最多只能指定 %d 个 DNS 服务器，忽略: %s\n", MAX_DNS_SERVERS, server);
+            continue;
+        }
+        config->dns_servers[config->dns_server_count++] = server;
+    }
+}
+
+/**
+ * 解析带 K、M、G 后缀 (1024 进制) 的字节数，无法解析时返回0
+ */
+static size_t parse_size(const char *value)
+{
+    char *end;
+    unsigned long long size = strtoull(value, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; break;
+        case 'm': case 'M': size <<= 20; break;
+        case 'g': case 'G': size <<= 30; break;
+        case '\0': break;
+        default: return 0;
+    }
+    return (size_t)size;
+}
 
 int parse_args(int argc, char **argv, struct Config *config)
 {
     config->port = 53;
-    config->cache_size = 2048;
+    config->cache_size = 16 << 20;
+    config->cache_policy = "tinylfu";
+    config->block_mode = "nxdomain";
     config->rto = 5000;
+    config->max_ttl = 86400;
+    config->stale_ttl = 86400;
+    config->stale_timeout = 1800;
+    config->prefetch = 10;
+    config->prefetch_hits = 8;
+    config->prefetch_rate = 100;
+    config->snapshot_interval = 300;
 
     cag_option_context context;
 
@@ -25,7 +69,7 @@ int parse_args(int argc, char **argv, struct Config *config)
                 config->debug_level = 2;
                 break;
             case 's':
-                config->dns_server_ipaddr = cag_option_get_value(&context);
+                parse_server_list(config, cag_option_get_value(&context));
                 break;
             case 'f':
                 config->filename = cag_option_get_value(&context);
@@ -36,8 +80,56 @@ int parse_args(int argc, char **argv, struct Config *config)
             case 'p':
                 config->port = atoi(cag_option_get_value(&context));
                 break;
+            case 'e':
+                config->hedge_percent = atoi(cag_option_get_value(&context));
+                if (config->hedge_percent < 0) config->hedge_percent = 0;
+                if (config->hedge_percent > 100) config->hedge_percent = 100;
+                break;
             case 'c':
-                config->cache_size = atoi(cag_option_get_value(&context));
+                config->cache_size = parse_size(cag_option_get_value(&context));
+                if (config->cache_size == 0) {
+                    printf("无法识别的 Cache 大小: %s\n", cag_option_get_value(&context));
+                    exit(1);
+                }
+                if (config->cache_size < CACHE_MIN_BUDGET) {
+                    // 旧版本的 -c 是条目数，例如 -c 2048 现在表示 2 KiB
+                    printf("Cache 大小 %s 是内存预算的字节数，小于下限 %dK，按 %dK 处理\n",
+                           cag_option_get_value(&context), CACHE_MIN_BUDGET >> 10, CACHE_MIN_BUDGET >> 10);
+                    config->cache_size = CACHE_MIN_BUDGET;
+                }
+                break;
+            case 'L':
+                config->cache_policy = cag_option_get_value(&context);
+                break;
+            case 'n':
+                config->min_ttl = atoi(cag_option_get_value(&context));
+                break;
+            case 'x':
+                config->max_ttl = atoi(cag_option_get_value(&context));
+                break;
+            case 'o':
+                config->stale_ttl = atoi(cag_option_get_value(&context));
+                break;
+            case 'w':
+                config->stale_timeout = atoi(cag_option_get_value(&context));
+                break;
+            case 'P':
+                config->prefetch = atoi(cag_option_get_value(&context));
+                break;
+            case 'H':
+                config->prefetch_hits = atoi(cag_option_get_value(&context));
+                break;
+            case 'R':
+                config->prefetch_rate = atoi(cag_option_get_value(&context));
+                break;
+            case 'B':
+                config->block_mode = cag_option_get_value(&context);
+                break;
+            case 'S':
+                config->snapshot = cag_option_get_value(&context);
+                break;
+            case 'I':
+                config->snapshot_interval = atoi(cag_option_get_value(&context));
                 break;
             case 'h':
                 printf("用法: dns-relay [OPTION]\n"
@@ -45,11 +137,27 @@ int parse_args(int argc, char **argv, struct Config *config)
                        "  -d, --debug               调试级别 1 (仅输出时间坐标、序号和查询的域名)\n"
                        "  -v, --verbose             调试级别 2 (输出冗长的调试信息)\n"
                        "  -h, --help                显示本帮助信息，然后退出\n"
-                       "  -s, --server=VALUE        使用指定的 DNS 服务器 (默认为校园 DNS)\n"
+                       "  -s, --server=VALUE        使用指定的 DNS 服务器，多个服务器用逗号分隔，\n"
+                       "                            可带端口如 8.8.8.8:53 或 [::1]:53 (默认为校园 DNS)\n"
                        "  -t, --timeout=VALUE       指定请求上级 DNS 服务器超时时间 (默认为 5000 ms)\n"
+                       "  -e, --hedge=PERCENT       开启对冲请求，对冲查询数不超过转发查询数的指定百分比 (默认关闭)\n"
                        "  -p, --port=VALUE          使用指定的端口号 (默认为 53)\n"
-                       "  -c, --cache=VALUE         指定 Cache 最大数量 (默认为 2048)\n"
-                       "  -f, --filename=FILE       使用指定的配置文件 (默认为 dnsrelay.txt)\n");
+                       "  -c, --cache=SIZE          指定 Cache 的内存预算字节数 (旧版本中为条目数)，可带 K、M、G 后缀，\n"
+                       "                            最小为 256K (默认为 16M)\n"
+                       "      --cache-policy=POLICY 缓存淘汰策略，lru 或 tinylfu (默认为 tinylfu)\n"
+                       "      --min-ttl=SECONDS     缓存条目的最小 TTL (默认为 0)\n"
+                       "      --max-ttl=SECONDS     缓存条目的最大 TTL (默认为 86400)\n"
+                       "      --stale-ttl=SECONDS   上游无法及时应答时，可使用过期不超过指定时间的缓存条目，\n"
+                       "                            0 表示关闭 (默认为 86400)\n"
+                       "      --stale-timeout=MS    等待上游应答超过指定时间后返回过期的缓存条目 (默认为 1800 ms)\n"
+                       "      --prefetch=PERCENT    热门缓存条目的剩余 TTL 低于指定百分比时预取，0 表示关闭 (默认为 10)\n"
+                       "      --prefetch-hits=N     缓存条目至少命中指定次数才会预取 (默认为 8)\n"
+                       "      --prefetch-rate=N     每秒最多发出的预取数 (默认为 100)\n"
+                       "      --block-mode=MODE     被黑名单匹配的查询的应答方式：nxdomain、refused、\n"
+                       "                            sinkhole (A/AAAA 应答 0.0.0.0/::) 或 nodata (默认为 nxdomain)\n"
+                       "      --snapshot=FILE       定期及退出时将缓存保存到指定的快照文件，启动时从中恢复 (默认关闭)\n"
+                       "      --snapshot-interval=SECONDS 保存快照的间隔 (默认为 300)\n"
+                       "  -f, --filename=FILE       使用指定的配置文件或 dns_relay_compile 编译的规则镜像 (默认为 dnsrelay.txt)\n");
                 exit(0);
             default:
                 printf("无法识别的选项: %c\n", identifier);
@@ -57,10 +165,18 @@ int parse_args(int argc, char **argv, struct Config *config)
         }
     }
 
+    if (config->min_ttl < 0) config->min_ttl = 0;
+    if (config->max_ttl < config->min_ttl) config->max_ttl = config->min_ttl;
+    if (config->stale_ttl < 0) config->stale_ttl = 0;
+    if (config->stale_timeout < 1) config->stale_timeout = 1;
+    if (config->prefetch < 0) config->prefetch = 0;
+    if (config->prefetch > 100) config->prefetch = 100;
+    if (config->snapshot_interval < 1) config->snapshot_interval = 1;
+
     // 如果没有指定 DNS 服务器，则使用默认的 DNS 服务器
-    if (config->dns_server_ipaddr == NULL) {
-//        config->dns_server_ipaddr = "223.5.5.5";  // 阿里 DNS
-        config->dns_server_ipaddr = "10.3.9.6";     // 校内 DNS
+    if (config->dns_server_count == 0) {
+//        config->dns_servers[config->dns_server_count++] = "223.5.5.5";  // 阿里 DNS
+        config->dns_servers[config->dns_server_count++] = "10.3.9.6";     // 校内 DNS
     }
 
     // 如果没有指定配置文件，则使用默认的配置文件
@@ -78,9 +194,19 @@ int parse_args(int argc, char **argv, struct Config *config)
 void dump_args(struct Config *config)
 {
     printf("debug_level: %d\n", config->debug_level);
-    printf("dns_server_ipaddr: %s\n", config->dns_server_ipaddr);
+    for (int i = 0; i < config->dns_server_count; ++i) {
+        printf("dns_server[%d]: %s\n", i, config->dns_servers[i]);
+    }
     printf("filename: %s\n", config->filename);
     printf("port: %d\n", config->port);
-    printf("cache_size: %d\n", config->cache_size);
+    printf("cache_size: %zu, policy: %s\n", config->cache_size, config->cache_policy);
     printf("rto: %d\n", config->rto);
+    printf("hedge_percent: %d\n", config->hedge_percent);
+    printf("min_ttl: %d\n", config->min_ttl);
+    printf("max_ttl: %d\n", config->max_ttl);
+    printf("stale_ttl: %d\n", config->stale_ttl);
+    printf("stale_timeout: %d\n", config->stale_timeout);
+    printf("prefetch: %d%%, hits: %d, rate: %d/s\n", config->prefetch, config->prefetch_hits, config->prefetch_rate);
+    printf("block_mode: %s\n", config->block_mode);
+    printf("snapshot: %s, interval: %d\n", config->snapshot ? config->snapshot : "(none)", config->snapshot_interval);
 }
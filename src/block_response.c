@@ -0,0 +1,72 @@
+#include "block_response.h"
+#include <string.h>
+#include <strings.h>
+
+static const char* const mode_names[] = {"nxdomain", "refused", "sinkhole", "nodata"};
+
+int block_mode_from_name(const char* name) {
+    for (int i = 0; i < (int)(sizeof(mode_names) / sizeof(mode_names[0])); ++i) {
+        if (strcasecmp(name, mode_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char* block_mode_name(block_mode_e mode) {
+    return mode_names[mode];
+}
+
+// 打包一条指向问题 (偏移12) 的记录，返回长度
+static int pack_record(uint8_t* p, uint16_t rtype, uint32_t ttl, const void* addr, uint16_t addrlen) {
+    p[0] = 0xC0;
+    p[1] = sizeof(dnshdr_t);
+    uint16_t u16 = htons(rtype);
+    memcpy(p + 2, &u16, 2);
+    u16 = htons(DNS_CLASS_IN);
+    memcpy(p + 4, &u16, 2);
+    uint32_t u32 = htonl(ttl);
+    memcpy(p + 6, &u32, 4);
+    u16 = htons(addrlen);
+    memcpy(p + 10, &u16, 2);
+    memcpy(p + 12, addr, addrlen);
+    return 12 + addrlen;
+}
+
+void block_response_init(block_response_t* block, block_mode_e mode, uint32_t ttl) {
+    static const uint8_t zero[16] = {0};
+    memset(block, 0, sizeof(block_response_t));
+    block->mode = mode;
+    block->hdr.qr = DNS_RESPONSE;
+    block->hdr.ra = 1;
+    block->hdr.rcode = mode == BLOCK_MODE_NXDOMAIN ? 3 : mode == BLOCK_MODE_REFUSED ? 5 : 0;
+    block->hdr.nquestion = htons(1);
+    pack_record(block->a, DNS_TYPE_A, ttl, zero, 4);
+    pack_record(block->aaaa, DNS_TYPE_AAAA, ttl, zero, 16);
+}
+
+int block_response_build(const block_response_t* block, const char* query, int qlen,
+                         uint16_t rtype, uint16_t rclass, char* buf) {
+    const dnshdr_t* qhdr = (const dnshdr_t*)query;
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    *hdr = block->hdr;
+    hdr->transaction_id = qhdr->transaction_id;
+    hdr->opcode = qhdr->opcode;
+    hdr->rd = qhdr->rd;
+    hdr->cd = qhdr->cd;
+    memcpy(buf + sizeof(dnshdr_t), query + sizeof(dnshdr_t), qlen);
+    int len = sizeof(dnshdr_t) + qlen;
+
+    if (block->mode != BLOCK_MODE_SINKHOLE || rclass != DNS_CLASS_IN) {
+        return len;
+    }
+    if (rtype == DNS_TYPE_A) {
+        memcpy(buf + len, block->a, sizeof(block->a));
+        len += sizeof(block->a);
+    } else if (rtype == DNS_TYPE_AAAA) {
+        memcpy(buf + len, block->aaaa, sizeof(block->aaaa));
+        len += sizeof(block->aaaa);
+    } else {
+        return len;
+    }
+    hdr->nanswer = htons(1);
+    return len;
+}
@@ -0,0 +1,467 @@
+#include "blocklist.h"
+#include "bloom.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define LABEL_SEP       '\1'    // 构建时反转域名中的标签分隔符，小于任何合法字符，使同一标签下的域名排序后相邻
+#define LABEL_MAXLEN    63
+#define NAME_MAXLEN     253
+// 过滤器中每条规则占用的位数，分块布隆过滤器的误判率约为1%
+#define FILTER_BITS_PER_KEY 10
+
+// 黑名单 Trie 树的节点，同一节点的子节点在数组中连续存放并按标签排序
+typedef struct blocklist_node_t {
+    uint32_t label;         // 标签在字符串池中的偏移，标签已转为小写
+    uint8_t label_len;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t first_child;
+    uint32_t nchildren;
+} blocklist_node_t;
+
+_Static_assert(sizeof(blocklist_node_t) == BLOCKLIST_NODE_SIZE, "blocklist node layout is part of the rules image");
+
+// 节点标志
+enum {
+    NODE_EXACT = 1,         // 从根到该节点的域名在黑名单中
+    NODE_SUBTREE = 2,       // 该域名的所有子域名都在黑名单中 (*.example.com)
+};
+
+struct blocklist_s {
+    blocklist_node_t* nodes;    // nodes[0] 为根节点
+    uint32_t nnodes;
+    char* labels;               // 字符串池
+    size_t labels_len;
+    size_t count;
+    bool mapped;                // 节点和字符串池引用外部内存 (规则镜像)，销毁时不释放
+    bloom_t filter;             // 规则域名及其祖先的布隆过滤器，在遍历 Trie 树之前排除绝大多数查询
+};
+
+struct blocklist_builder_s {
+    char* names;            // 反转后的域名，以 '\0' 分隔
+    size_t names_len, names_cap;
+    size_t* offsets;        // 各域名在 names 中的偏移
+    size_t count, cap;
+};
+
+blocklist_builder_t* blocklist_builder_create(void) {
+    return (blocklist_builder_t*)calloc(1, sizeof(blocklist_builder_t));
+}
+
+void blocklist_builder_free(blocklist_builder_t* builder) {
+    if (builder == NULL) return;
+    free(builder->names);
+    free(builder->offsets);
+    free(builder);
+}
+
+// 添加一条反转后的规则，name 的前 len 个字符为域名，只有最左边的标签可以是 *
+static int add_name(blocklist_builder_t* builder, const char* name, size_t len) {
+    if (len > 0 && name[len - 1] == '.') --len;
+    if (len == 0 || len > NAME_MAXLEN) return -1;
+
+    if (builder->names_len + len + 1 > builder->names_cap) {
+        size_t cap = builder->names_cap ? builder->names_cap * 2 : 4096;
+        while (cap < builder->names_len + len + 1) cap *= 2;
+        char* names = (char*)realloc(builder->names, cap);
+        if (names == NULL) return -1;
+        builder->names = names;
+        builder->names_cap = cap;
+    }
+    if (builder->count == builder->cap) {
+        size_t cap = builder->cap ? builder->cap * 2 : 1024;
+        size_t* offsets = (size_t*)realloc(builder->offsets, sizeof(size_t) * cap);
+        if (offsets == NULL) return -1;
+        builder->offsets = offsets;
+        builder->cap = cap;
+    }
+
+    // 从右往左逐个复制标签：ads.example.com -> com\1example\1ads
+    char* out = builder->names + builder->names_len;
+    size_t n = 0;
+    size_t end = len;
+    for (;;) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') --start;
+        size_t label_len = end - start;
+        if (label_len == 0 || label_len > LABEL_MAXLEN) return -1;
+        for (size_t i = start; i < end; ++i) {
+            unsigned char c = (unsigned char)name[i];
+            if (c <= ' ' || (c == '*' && (start != 0 || label_len != 1))) return -1;
+            out[n++] = (char)tolower(c);
+        }
+        if (start == 0) break;
+        out[n++] = LABEL_SEP;
+        end = start - 1;
+    }
+    out[n] = '\0';
+    builder->offsets[builder->count++] = builder->names_len;
+    builder->names_len += n + 1;
+    return 0;
+}
+
+int blocklist_builder_add(blocklist_builder_t* builder, const char* rule) {
+    size_t len = strlen(rule);
+    // ||example.com^ 等价于 example.com 和 *.example.com 两条规则
+    if (len > 3 && strncmp(rule, "||", 2) == 0 && rule[len - 1] == '^') {
+        char wildcard[NAME_MAXLEN + 3] = "*.";
+        len -= 3;
+        if (len > NAME_MAXLEN) return -1;
+        memcpy(wildcard + 2, rule + 2, len);
+        if (add_name(builder, rule + 2, len) != 0) return -1;
+        return add_name(builder, wildcard, len + 2);
+    }
+    return add_name(builder, rule, len);
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+void blocklist_builder_sort(blocklist_builder_t* builder) {
+    if (builder->count == 0) return;
+    // 按字符串指针排序，不依赖全局状态，多个构建器可以在不同线程中同时排序
+    const char** names = (const char**)malloc(sizeof(const char*) * builder->count);
+    for (size_t i = 0; i < builder->count; ++i) {
+        names[i] = builder->names + builder->offsets[i];
+    }
+    qsort(names, builder->count, sizeof(const char*), compare_names);
+    // 去重
+    size_t count = 0;
+    for (size_t i = 0; i < builder->count; ++i) {
+        if (count == 0 || strcmp(names[count - 1], names[i]) != 0) {
+            names[count++] = names[i];
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        builder->offsets[i] = names[i] - builder->names;
+    }
+    builder->count = count;
+    free(names);
+}
+
+// 构建过程中节点对应的已排序域名区间 [lo, hi)，子节点的标签从各域名的第 off 字节开始
+typedef struct build_range_t {
+    uint32_t lo, hi;
+    uint32_t off;
+} build_range_t;
+
+// 合并多个已排序的构建器：拼接字符串，多路归并偏移并去重，结果保存在 merged 中
+static void merge_builders(blocklist_builder_t** builders, int n, blocklist_builder_t* merged) {
+    size_t names_len = 0, count = 0;
+    for (int i = 0; i < n; ++i) {
+        names_len += builders[i]->names_len;
+        count += builders[i]->count;
+    }
+    merged->names = (char*)malloc(names_len > 0 ? names_len : 1);
+    merged->offsets = (size_t*)malloc(sizeof(size_t) * (count > 0 ? count : 1));
+    size_t* base = (size_t*)malloc(sizeof(size_t) * n);
+    size_t* pos = (size_t*)calloc(n, sizeof(size_t));
+    for (int i = 0; i < n; ++i) {
+        base[i] = merged->names_len;
+        memcpy(merged->names + merged->names_len, builders[i]->names, builders[i]->names_len);
+        merged->names_len += builders[i]->names_len;
+    }
+
+    // 路数等于线程数，逐个比较各路的当前最小值即可
+    for (;;) {
+        int best = -1;
+        const char* best_name = NULL;
+        for (int i = 0; i < n; ++i) {
+            if (pos[i] == builders[i]->count) continue;
+            const char* name = merged->names + base[i] + builders[i]->offsets[pos[i]];
+            if (best < 0 || strcmp(name, best_name) < 0) {
+                best = i;
+                best_name = name;
+            }
+        }
+        if (best < 0) break;
+        ++pos[best];
+        if (merged->count == 0 || strcmp(merged->names + merged->offsets[merged->count - 1], best_name) != 0) {
+            merged->offsets[merged->count++] = best_name - merged->names;
+        }
+    }
+    free(pos);
+    free(base);
+}
+
+/**
+ * @brief 构建过滤器
+ *
+ * 键为反转后的规则域名 (通配规则为 com\1example\1*) 及其所有至少两个标签的祖先 (com\1example)，
+ * 与查询时从右往左逐个标签计算的哈希值一致。祖先不在过滤器中时其下不可能有规则，查询到此为止，
+ * 因此大多数查询只需查询一次过滤器。只有一个标签的规则 (例如 *.cn) 由根节点的子节点判断。
+ */
+static void build_filter(blocklist_t* blocklist, const char* names, const size_t* offsets, size_t count) {
+    // 域名已排序，祖先不是上一个域名的前缀时才是新的键，据此估计键数
+    size_t nkeys = count;
+    const char* prev = "";
+    for (size_t i = 0; i < count; ++i) {
+        const char* name = names + offsets[i];
+        size_t common = 0;
+        while (name[common] != '\0' && name[common] == prev[common]) ++common;
+        for (const char* p = strchr(name, LABEL_SEP); p != NULL; p = strchr(p + 1, LABEL_SEP)) {
+            if ((size_t)(p - name) >= common) ++nkeys;
+        }
+        prev = name;
+    }
+
+    bloom_init(&blocklist->filter, nkeys, FILTER_BITS_PER_KEY);
+    for (size_t i = 0; i < count; ++i) {
+        const char* name = names + offsets[i];
+        const char* sep = strchr(name, LABEL_SEP);
+        if (sep == NULL) continue;
+        // 从第二个标签起，每个标签结束处的哈希值对应一个祖先
+        uint64_t hash = bloom_hash(BLOOM_HASH_INIT, name, sep - name);
+        for (const char* p = sep;;) {
+            const char* next = strchr(p + 1, LABEL_SEP);
+            size_t len = next != NULL ? (size_t)(next - p) : strlen(p);
+            hash = bloom_hash(hash, p, len);
+            bloom_add(&blocklist->filter, hash);
+            if (next == NULL) break;
+            p = next;
+        }
+    }
+}
+
+blocklist_t* blocklist_build(blocklist_builder_t* builder) {
+    blocklist_builder_sort(builder);
+    return blocklist_build_merged(&builder, 1);
+}
+
+blocklist_t* blocklist_build_merged(blocklist_builder_t** builders, int n) {
+    blocklist_builder_t* builder = builders[0];
+    if (n > 1) {
+        builder = blocklist_builder_create();
+        merge_builders(builders, n, builder);
+        for (int i = 0; i < n; ++i) {
+            blocklist_builder_free(builders[i]);
+        }
+    }
+    blocklist_t* blocklist = (blocklist_t*)calloc(1, sizeof(blocklist_t));
+    const char* names = builder->names;
+    size_t* offsets = builder->offsets;
+    size_t count = builder->count;
+    blocklist->count = count;
+    build_filter(blocklist, names, offsets, count);
+
+    // 节点数组本身就是广度优先遍历的队列：依次处理每个节点，把它的子节点一次性追加到数组末尾
+    size_t cap = 64, labels_cap = 4096;
+    blocklist->nodes = (blocklist_node_t*)calloc(cap, sizeof(blocklist_node_t));
+    blocklist->labels = (char*)malloc(labels_cap);
+    build_range_t* ranges = (build_range_t*)malloc(sizeof(build_range_t) * cap);
+    blocklist->nnodes = 1;
+    ranges[0].lo = 0;
+    ranges[0].hi = (uint32_t)count;
+    ranges[0].off = 0;
+
+    for (uint32_t i = 0; i < blocklist->nnodes; ++i) {
+        build_range_t range = ranges[i];
+        blocklist->nodes[i].first_child = blocklist->nnodes;
+        uint32_t j = range.lo;
+        while (j < range.hi) {
+            const char* label = names + offsets[j] + range.off;
+            size_t label_len = strcspn(label, "\1");
+            // 标签相同的域名排序后相邻
+            uint32_t k = j + 1;
+            // * 只会是最后一个标签，不建节点，直接标记父节点
+            if (label_len == 1 && label[0] == '*') {
+                blocklist->nodes[i].flags |= NODE_SUBTREE;
+                j = k;
+                continue;
+            }
+            while (k < range.hi) {
+                const char* other = names + offsets[k] + range.off;
+                if (memcmp(other, label, label_len) != 0 || (other[label_len] != LABEL_SEP && other[label_len] != '\0')) {
+                    break;
+                }
+                ++k;
+            }
+
+            if (blocklist->nnodes == cap) {
+                cap *= 2;
+                blocklist->nodes = (blocklist_node_t*)realloc(blocklist->nodes, sizeof(blocklist_node_t) * cap);
+                ranges = (build_range_t*)realloc(ranges, sizeof(build_range_t) * cap);
+            }
+            if (blocklist->labels_len + label_len > labels_cap) {
+                while (blocklist->labels_len + label_len > labels_cap) labels_cap *= 2;
+                blocklist->labels = (char*)realloc(blocklist->labels, labels_cap);
+            }
+            uint32_t child = blocklist->nnodes++;
+            blocklist_node_t* node = &blocklist->nodes[child];
+            memset(node, 0, sizeof(*node));
+            node->label = (uint32_t)blocklist->labels_len;
+            node->label_len = (uint8_t)label_len;
+            memcpy(blocklist->labels + blocklist->labels_len, label, label_len);
+            blocklist->labels_len += label_len;
+            // 恰好在该标签结束的域名排在最前面
+            ranges[child].lo = j;
+            if (label[label_len] == '\0') {
+                node->flags |= NODE_EXACT;
+                ++ranges[child].lo;
+            }
+            ranges[child].hi = k;
+            ranges[child].off = range.off + (uint32_t)label_len + 1;
+            ++blocklist->nodes[i].nchildren;
+            j = k;
+        }
+    }
+
+    free(ranges);
+    blocklist_builder_free(builder);
+    // 释放多余的容量
+    blocklist->nodes = (blocklist_node_t*)realloc(blocklist->nodes, sizeof(blocklist_node_t) * blocklist->nnodes);
+    if (blocklist->labels_len > 0) {
+        blocklist->labels = (char*)realloc(blocklist->labels, blocklist->labels_len);
+    }
+    return blocklist;
+}
+
+void blocklist_destroy(blocklist_t* blocklist) {
+    if (blocklist == NULL) return;
+    if (!blocklist->mapped) {
+        free(blocklist->nodes);
+        free(blocklist->labels);
+    }
+    bloom_free(&blocklist->filter);
+    free(blocklist);
+}
+
+void blocklist_export(const blocklist_t* blocklist, blocklist_image_t* image) {
+    image->nodes = blocklist->nodes;
+    image->nnodes = blocklist->nnodes;
+    image->labels = blocklist->labels;
+    image->labels_len = blocklist->labels_len;
+    image->count = blocklist->count;
+    image->filter = blocklist->filter.blocks;
+    image->filter_blocks = blocklist->filter.nblocks;
+    image->filter_k = blocklist->filter.k;
+}
+
+blocklist_t* blocklist_import(const blocklist_image_t* image) {
+    // 镜像来自文件，查询前检查所有下标都不越界，且子节点总在父节点之后，保证查询一定结束
+    if (image->nnodes == 0) return NULL;
+    if (image->filter_blocks > 0 && (image->filter_k == 0 || image->filter_k > 16)) return NULL;
+    const blocklist_node_t* nodes = (const blocklist_node_t*)image->nodes;
+    for (uint32_t i = 0; i < image->nnodes; ++i) {
+        const blocklist_node_t* node = &nodes[i];
+        if ((size_t)node->label + node->label_len > image->labels_len) return NULL;
+        if (node->nchildren > 0 &&
+            (node->first_child <= i || node->nchildren > image->nnodes ||
+             node->first_child > image->nnodes - node->nchildren)) {
+            return NULL;
+        }
+    }
+    blocklist_t* blocklist = (blocklist_t*)calloc(1, sizeof(blocklist_t));
+    blocklist->nodes = (blocklist_node_t*)image->nodes;
+    blocklist->nnodes = image->nnodes;
+    blocklist->labels = (char*)image->labels;
+    blocklist->labels_len = image->labels_len;
+    blocklist->count = image->count;
+    blocklist->mapped = true;
+    blocklist->filter.blocks = (uint64_t*)image->filter;
+    blocklist->filter.nblocks = image->filter_blocks;
+    blocklist->filter.k = image->filter_k;
+    blocklist->filter.mapped = true;
+    return blocklist;
+}
+
+// 比较查询中的标签与节点的标签，顺序与构建时的排序一致
+static int compare_label(const char* label, size_t len, const char* node_label, size_t node_len) {
+    size_t n = len < node_len ? len : node_len;
+    for (size_t i = 0; i < n; ++i) {
+        int diff = (unsigned char)tolower((unsigned char)label[i]) - (unsigned char)node_label[i];
+        if (diff != 0) return diff;
+    }
+    return (int)len - (int)node_len;
+}
+
+// 在子节点中二分查找标签，不存在时返回 NULL
+static const blocklist_node_t* find_child(const blocklist_t* blocklist, const blocklist_node_t* node,
+                                          const char* label, size_t len) {
+    uint32_t lo = node->first_child, hi = node->first_child + node->nchildren;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const blocklist_node_t* child = &blocklist->nodes[mid];
+        int cmp = compare_label(label, len, blocklist->labels + child->label, child->label_len);
+        if (cmp == 0) return child;
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+// 沿 Trie 树精确匹配域名的前 end 个字符
+static bool blocklist_walk(const blocklist_t* blocklist, const char* name, size_t end) {
+    // 从最右边的标签开始沿 Trie 树向下，一次遍历同时匹配完整域名和通配规则
+    const blocklist_node_t* node = &blocklist->nodes[0];
+    for (;;) {
+        // 还有剩余的标签，即查询的是该节点的子域名
+        if (node->flags & NODE_SUBTREE) return true;
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') --start;
+        node = find_child(blocklist, node, name + start, end - start);
+        if (node == NULL) return false;
+        if (start == 0) break;
+        end = start - 1;
+    }
+    return (node->flags & NODE_EXACT) != 0;
+}
+
+/**
+ * @brief 查询过滤器，域名可能被规则匹配时返回 true
+ *
+ * 顶级域名在根节点的子节点中查找：它们数量很少且常驻缓存。更长的后缀从右往左逐个标签延长：
+ * 后缀不在过滤器中时其下没有规则，直接返回 false；否则再查询该后缀的通配规则。
+ */
+static bool filter_may_contain(const blocklist_t* blocklist, const char* name, size_t end) {
+    static const char subtree[] = {LABEL_SEP, '*'};
+    const blocklist_node_t* root = &blocklist->nodes[0];
+    if (root->flags & NODE_SUBTREE) return true;
+    size_t start = end;
+    while (start > 0 && name[start - 1] != '.') --start;
+    const blocklist_node_t* node = find_child(blocklist, root, name + start, end - start);
+    if (node == NULL) return false;
+    if (node->flags != 0) return true;
+
+    uint64_t hash = BLOOM_HASH_INIT;
+    for (size_t i = start; i < end; ++i) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)name[i])) * BLOOM_HASH_PRIME;
+    }
+    while (start > 0) {
+        end = start - 1;
+        start = end;
+        while (start > 0 && name[start - 1] != '.') --start;
+        hash = (hash ^ (uint8_t)LABEL_SEP) * BLOOM_HASH_PRIME;
+        for (size_t i = start; i < end; ++i) {
+            hash = (hash ^ (uint8_t)tolower((unsigned char)name[i])) * BLOOM_HASH_PRIME;
+        }
+        if (!bloom_may_contain(&blocklist->filter, hash)) return false;
+        // 整个域名都在过滤器中，可能有完全匹配的规则
+        if (start == 0) return true;
+        if (bloom_may_contain(&blocklist->filter, bloom_hash(hash, subtree, sizeof(subtree)))) return true;
+    }
+    return false;
+}
+
+int blocklist_lookup(const blocklist_t* blocklist, const char* name) {
+    size_t end = strlen(name);
+    if (end > 0 && name[end - 1] == '.') --end;
+    if (end == 0 || !filter_may_contain(blocklist, name, end)) return BLOCKLIST_FILTERED;
+    return blocklist_walk(blocklist, name, end) ? BLOCKLIST_MATCHED : BLOCKLIST_UNMATCHED;
+}
+
+bool blocklist_contains(const blocklist_t* blocklist, const char* name) {
+    return blocklist_lookup(blocklist, name) == BLOCKLIST_MATCHED;
+}
+
+size_t blocklist_size(const blocklist_t* blocklist) {
+    return blocklist->count;
+}
+
+size_t blocklist_memory(const blocklist_t* blocklist) {
+    return sizeof(blocklist_t) + sizeof(blocklist_node_t) * blocklist->nnodes + blocklist->labels_len +
+           bloom_memory(&blocklist->filter);
+}
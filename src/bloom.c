@@ -0,0 +1,75 @@
+#include "bloom.h"
+#include <stdlib.h>
+#include <string.h>
+
+void bloom_init(bloom_t* bloom, size_t nkeys, int bits_per_key) {
+    memset(bloom, 0, sizeof(bloom_t));
+    if (nkeys == 0) return;
+    size_t bits = nkeys * bits_per_key;
+    bloom->nblocks = (uint32_t)((bits + BLOOM_BLOCK_SIZE * 8 - 1) / (BLOOM_BLOCK_SIZE * 8));
+    // 最优的 k 约为 bits_per_key * ln2
+    bloom->k = (uint32_t)(bits_per_key * 69 / 100);
+    if (bloom->k < 1) bloom->k = 1;
+    if (bloom->k > 16) bloom->k = 16;
+    bloom->blocks = (uint64_t*)calloc(bloom->nblocks, BLOOM_BLOCK_SIZE);
+}
+
+// 混合哈希值的各位 (MurmurHash3 的 fmix64)，使高低32位都均匀
+static inline uint64_t bloom_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// 由哈希值的高32位选块，块数不必是2的幂
+static inline const uint64_t* bloom_block(const bloom_t* bloom, uint64_t hash) {
+    uint32_t index = (uint32_t)(((hash >> 32) * bloom->nblocks) >> 32);
+    return bloom->blocks + (size_t)index * BLOOM_BLOCK_WORDS;
+}
+
+void bloom_add(bloom_t* bloom, uint64_t hash) {
+    if (bloom->nblocks == 0) return;
+    hash = bloom_mix(hash);
+    uint64_t* block = (uint64_t*)bloom_block(bloom, hash);
+    // 低32位按双重哈希生成块内的 k 个位置
+    uint32_t h = (uint32_t)hash;
+    uint32_t delta = (h >> 17) | (h << 15);
+    for (uint32_t i = 0; i < bloom->k; ++i) {
+        uint32_t bit = h & (BLOOM_BLOCK_SIZE * 8 - 1);
+        block[bit >> 6] |= 1ull << (bit & 63);
+        h += delta;
+    }
+}
+
+bool bloom_may_contain(const bloom_t* bloom, uint64_t hash) {
+    if (bloom->nblocks == 0) return false;
+    hash = bloom_mix(hash);
+    const uint64_t* block = bloom_block(bloom, hash);
+    uint32_t h = (uint32_t)hash;
+    uint32_t delta = (h >> 17) | (h << 15);
+    for (uint32_t i = 0; i < bloom->k; ++i) {
+        uint32_t bit = h & (BLOOM_BLOCK_SIZE * 8 - 1);
+        if ((block[bit >> 6] & (1ull << (bit & 63))) == 0) return false;
+        h += delta;
+    }
+    return true;
+}
+
+size_t bloom_memory(const bloom_t* bloom) {
+    return (size_t)bloom->nblocks * BLOOM_BLOCK_SIZE;
+}
+
+void bloom_free(bloom_t* bloom) {
+    if (!bloom->mapped) {
+        free(bloom->blocks);
+    }
+    memset(bloom, 0, sizeof(bloom_t));
+}
+
+uint64_t bloom_hash(uint64_t hash, const char* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ (uint8_t)data[i]) * BLOOM_HASH_PRIME;
+    }
+    return hash;
+}
@@ -1,182 +1,893 @@
 #include "cache.h"
+#include <hv/hplatform.h>
+#include <hv/hdef.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#ifdef OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
-#define N 38 // 0-9, -, ., A-Z, a-z 共 38 个字符
+#define EMPTY_HASH  0           // 空槽位的哈希值，真实哈希值不为0；空闲块的 hash 字段也为0
+#define NIL         UINT32_MAX  // 空的节点下标
 
+// Slab 分配器参数：预留的内存区按页划分，每页只切分同一大小类别的块
+#define PAGE_SIZE       (16 * 1024)
+#define CHUNK_ALIGN     16      // 块大小和地址的对齐，节点下标即块在内存区中的偏移 / CHUNK_ALIGN
+#define CHUNKS_SHIFT    10      // log2(PAGE_SIZE / CHUNK_ALIGN)，节点下标右移得到页号
+#define MIN_CHUNK       64
+#define CLASS_FACTOR    1.25    // 相邻大小类别的比例
+#define MAX_CLASSES     48
+#define RECLAIM_AFTER   32      // 连续淘汰这么多条目仍没有可用块时，整页回收下一个淘汰者所在的页
+
+// TinyLFU 参数
+#define SKETCH_DEPTH    4       // Count-Min Sketch 的行数
+#define SKETCH_MAX      15      // 计数器上限
+#define WINDOW_PERCENT  1       // 窗口区占总容量的百分比
+
+// 节点所在的区，仅 TinyLFU 使用
+enum {
+    SEGMENT_WINDOW,
+    SEGMENT_MAIN,
+};
+
+// 哈希表槽位，只保存哈希值和节点下标，一个缓存行可容纳8个槽位
+typedef struct slot_t {
+    uint32_t hash;
+    uint32_t node;
+} slot_t;
+
+// 缓存节点，位于 slab 块的开头，之后依次是键 (以 '\0' 结尾，按8字节对齐) 和值
 typedef struct lru_node_t {
-    char* key;
-    char* value;
-    struct lru_node_t* prev;
-    struct lru_node_t* next;
+    uint64_t expire;
+    uint32_t hash;      // EMPTY_HASH 表示空闲块
+    uint32_t prev;      // LRU 链表或 CLOCK 环，保存节点下标
+    uint32_t next;      // 空闲块复用为页内空闲链表
+    uint32_t len;
+    uint16_t keylen;
+    uint8_t ref;        // CLOCK 访问位
+    uint8_t segment;
+    uint8_t cls;        // 块的大小类别
+    uint8_t reserved[3];// 使 data 按8字节对齐，值中的字段可以原地读写
+    char data[];
 } lru_node_t;
 
-typedef struct trie_node_t {
-    struct trie_node_t* children[N];
-    lru_node_t* lru_node;
-    int is_end_of_word;
-} trie_node_t;
+_Static_assert(offsetof(lru_node_t, data) % 8 == 0, "cached values must be 8-byte aligned");
+
+// 大小类别，partial 是还有空闲块的页组成的双向链表
+typedef struct slab_class_t {
+    uint32_t size;
+    uint32_t partial;
+} slab_class_t;
+
+// 页描述符
+typedef struct slab_page_t {
+    uint32_t free;      // 页内第一个空闲块
+    uint32_t prev;      // 所在的 partial 链表或空闲页链表
+    uint32_t next;
+    uint16_t used;      // 已分配的块数
+    uint8_t cls;
+} slab_page_t;
+
+// 淘汰策略，负责维护节点的顺序并选出淘汰的节点
+typedef struct cache_policy_ops_t {
+    const char* name;
+    // 新节点已加入哈希表，由策略链接，可以在此淘汰其他节点
+    void (*admit)(cache_t* cache, uint32_t index);
+    // 节点被命中或更新
+    void (*touch)(cache_t* cache, uint32_t index);
+    // 节点即将被删除
+    void (*unlink)(cache_t* cache, uint32_t index);
+    // 记录一次对键的访问，可为 NULL
+    void (*record)(cache_t* cache, uint32_t hash);
+    // 内存不足时选出下一个淘汰的节点，缓存不为空
+    uint32_t (*victim)(cache_t* cache);
+    // 按从旧到新的顺序遍历节点，first 的参数为 NIL
+    uint32_t (*next_oldest)(cache_t* cache, uint32_t index);
+} cache_policy_ops_t;
 
 struct cache_t {
-    trie_node_t* root;
-    lru_node_t* head;
-    lru_node_t* tail;
-    int capacity;
+    slot_t* slots;      // Robin Hood 开放寻址哈希表
+    uint32_t mask;      // 槽位数 - 1，槽位数为2的幂
     int size;
+    int max_entries;    // 条目数上限，保证哈希表负载因子不超过 0.75
+    const cache_policy_ops_t* policy;
+    cache_stats_t stats;
+
+    // Slab 分配器
+    char* arena;            // 预留的内存区，按需逐页使用
+    slab_page_t* pages;
+    uint32_t npages;
+    uint32_t next_page;     // 从未使用过的第一页，之前的页都已驻留内存
+    uint32_t free_pages;    // 已清空的页组成的链表
+    slab_class_t classes[MAX_CLASSES];
+    int nclasses;
+    size_t used_bytes;      // 已分配块的总大小
+    size_t overhead_bytes;  // 哈希表、页描述符等固定开销
+
+    // LRU
+    uint32_t head;
+    uint32_t tail;
+
+    // W-TinyLFU：窗口区和主区各是一个 CLOCK 环，hand 指向下一个检查的节点，容量按字节计
+    uint32_t window_hand;
+    uint32_t main_hand;
+    size_t window_bytes, window_cap;
+    size_t main_bytes, main_cap;
+    uint8_t* sketch;        // SKETCH_DEPTH 行计数器
+    uint32_t sketch_bits;   // 每行 2^sketch_bits 个计数器
+    uint32_t sketch_adds;   // 自上次衰减以来的计数次数
+    uint32_t sketch_sample; // 达到该次数后所有计数器减半
 };
 
-// Helper functions for Trie and LRU
-int char_to_index(char c) {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c == '-') return 10;
-    if (c == '.') return 11;
-    if (c >= 'A' && c <= 'Z') return c - 'A' + 12;
-    if (c >= 'a' && c <= 'z') return c - 'a' + 12;
-    return -1;
+static void remove_node(cache_t* cache, uint32_t index);
+static void evict_node(cache_t* cache, uint32_t index);
+
+static inline lru_node_t* node_at(cache_t* cache, uint32_t index) {
+    return (lru_node_t*)(cache->arena + (size_t)index * CHUNK_ALIGN);
+}
+
+static inline char* node_value(lru_node_t* node) {
+    return node->data + ((node->keylen + 1 + 7) & ~7);
 }
 
-trie_node_t* create_trie_node() {
-    trie_node_t* node = (trie_node_t*)malloc(sizeof(trie_node_t));
-    node->is_end_of_word = 0;
-    node->lru_node = NULL;
-    for (int i = 0; i < N; ++i) {
-        node->children[i] = NULL;
+static inline uint32_t chunk_size(cache_t* cache, uint32_t index) {
+    return cache->classes[node_at(cache, index)->cls].size;
+}
+
+// 键的哈希值，不区分大小写 (FNV-1a)
+static uint32_t hash_key(const char* key) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = key; *p; ++p) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*p)) * 16777619u;
     }
-    return node;
+    return hash == EMPTY_HASH ? 1 : hash;
 }
 
-lru_node_t* create_lru_node(const char* key, const char* value) {
-    lru_node_t* node = (lru_node_t*)malloc(sizeof(lru_node_t));
-    node->key = strdup(key);
-    node->value = strdup(value);
-    node->prev = NULL;
-    node->next = NULL;
-    return node;
+// 槽位到其理想位置的距离
+static uint32_t probe_distance(cache_t* cache, uint32_t pos, uint32_t hash) {
+    return (pos - (hash & cache->mask)) & cache->mask;
 }
 
-// Cache functions
-cache_t* cache_create(int capacity) {
-    cache_t* cache = (cache_t*)malloc(sizeof(cache_t));
-    cache->root = create_trie_node();
-    cache->head = NULL;
-    cache->tail = NULL;
-    cache->capacity = capacity;
-    cache->size = 0;
-    return cache;
+// 查找键所在的槽位，不存在时返回 NIL
+static uint32_t find_slot(cache_t* cache, const char* key, uint32_t hash) {
+    uint32_t pos = hash & cache->mask;
+    for (uint32_t dist = 0; ; ++dist, pos = (pos + 1) & cache->mask) {
+        slot_t* slot = &cache->slots[pos];
+        // 遇到空槽位或更靠近理想位置的元素，说明键不存在
+        if (slot->hash == EMPTY_HASH || probe_distance(cache, pos, slot->hash) < dist) {
+            return NIL;
+        }
+        if (slot->hash == hash && strcasecmp(node_at(cache, slot->node)->data, key) == 0) {
+            return pos;
+        }
+    }
 }
 
-void free_trie_node(trie_node_t* node) {
-    for (int i = 0; i < N; ++i) {
-        if (node->children[i]) {
-            free_trie_node(node->children[i]);
+// 插入一个确定不存在的键，沿途与更靠近理想位置的元素交换
+static void insert_slot(cache_t* cache, uint32_t hash, uint32_t node) {
+    slot_t entry = {hash, node};
+    uint32_t pos = hash & cache->mask;
+    for (uint32_t dist = 0; ; ++dist, pos = (pos + 1) & cache->mask) {
+        slot_t* slot = &cache->slots[pos];
+        if (slot->hash == EMPTY_HASH) {
+            *slot = entry;
+            return;
+        }
+        uint32_t slot_dist = probe_distance(cache, pos, slot->hash);
+        if (slot_dist < dist) {
+            slot_t tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+            dist = slot_dist;
         }
     }
-    free(node);
 }
 
-void cache_destroy(cache_t* cache) {
-    // 释放LRU链表中的所有节点
-    lru_node_t* current = cache->head;
-    while (current) {
-        lru_node_t* next = current->next;
-        free(current->key);
-        free(current->value);
-        free(current);
-        current = next;
+// 删除槽位，后续元素向前移动 (backward shift)，不留墓碑
+static void remove_slot(cache_t* cache, uint32_t pos) {
+    for (;;) {
+        uint32_t next = (pos + 1) & cache->mask;
+        slot_t* slot = &cache->slots[next];
+        if (slot->hash == EMPTY_HASH || probe_distance(cache, next, slot->hash) == 0) {
+            break;
+        }
+        cache->slots[pos] = *slot;
+        pos = next;
     }
+    cache->slots[pos].hash = EMPTY_HASH;
+    cache->slots[pos].node = NIL;
+}
 
-    // 释放Trie树中的所有节点
-    free_trie_node(cache->root);
+/* ---------------- LRU ---------------- */
 
-    // 释放cache结构体本身
-    free(cache);
+static void lru_unlink(cache_t* cache, uint32_t index) {
+    lru_node_t* node = node_at(cache, index);
+    if (node->prev != NIL) node_at(cache, node->prev)->next = node->next;
+    else cache->head = node->next;
+    if (node->next != NIL) node_at(cache, node->next)->prev = node->prev;
+    else cache->tail = node->prev;
+}
+
+static void lru_push_front(cache_t* cache, uint32_t index) {
+    lru_node_t* node = node_at(cache, index);
+    node->prev = NIL;
+    node->next = cache->head;
+    if (cache->head != NIL) node_at(cache, cache->head)->prev = index;
+    cache->head = index;
+    if (cache->tail == NIL) cache->tail = index;
+}
+
+static void lru_admit(cache_t* cache, uint32_t index) {
+    lru_push_front(cache, index);
+}
+
+// 命中时移到链表头部
+static void lru_touch(cache_t* cache, uint32_t index) {
+    if (index != cache->head) {
+        lru_unlink(cache, index);
+        lru_push_front(cache, index);
+    }
+}
+
+static uint32_t lru_victim(cache_t* cache) {
+    return cache->tail;
 }
 
-void cache_insert(cache_t* cache, const char* key, const char* value) {
-    trie_node_t* node = cache->root;
-    int length = strlen(key);
-    for (int i = 0; i < length; ++i) {
-        int index = char_to_index(key[i]);
-        if (index == -1) continue;
-        if (node->children[index] == NULL) {
-            node->children[index] = create_trie_node();
+static uint32_t lru_next_oldest(cache_t* cache, uint32_t index) {
+    return index == NIL ? cache->tail : node_at(cache, index)->prev;
+}
+
+static const cache_policy_ops_t lru_policy = {
+    "lru", lru_admit, lru_touch, lru_unlink, NULL, lru_victim, lru_next_oldest,
+};
+
+/* ---------------- W-TinyLFU ---------------- */
+
+// 第 row 行中键对应的计数器
+static uint8_t* sketch_counter(cache_t* cache, uint32_t hash, int row) {
+    static const uint32_t seeds[SKETCH_DEPTH] = {0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu};
+    uint32_t h = (hash ^ (hash >> 15)) * seeds[row];
+    return &cache->sketch[(row << cache->sketch_bits) + (h >> (32 - cache->sketch_bits))];
+}
+
+static int sketch_estimate(cache_t* cache, uint32_t hash) {
+    int freq = SKETCH_MAX;
+    for (int i = 0; i < SKETCH_DEPTH; ++i) {
+        freq = MIN(freq, *sketch_counter(cache, hash, i));
+    }
+    return freq;
+}
+
+// 保守更新：只增加等于最小值的计数器；计数次数达到采样数后全部减半，使频率随时间衰减
+static void tinylfu_record(cache_t* cache, uint32_t hash) {
+    int freq = sketch_estimate(cache, hash);
+    if (freq == SKETCH_MAX) return;
+    for (int i = 0; i < SKETCH_DEPTH; ++i) {
+        uint8_t* counter = sketch_counter(cache, hash, i);
+        if (*counter == freq) ++*counter;
+    }
+    if (++cache->sketch_adds >= cache->sketch_sample) {
+        size_t n = (size_t)SKETCH_DEPTH << cache->sketch_bits;
+        for (size_t i = 0; i < n; ++i) cache->sketch[i] >>= 1;
+        cache->sketch_adds /= 2;
+    }
+}
+
+// 将节点插入 CLOCK 环中 hand 之前，即最后才会被检查的位置
+static void ring_insert(cache_t* cache, uint32_t* hand, uint32_t index) {
+    lru_node_t* node = node_at(cache, index);
+    if (*hand == NIL) {
+        node->prev = node->next = index;
+        *hand = index;
+        return;
+    }
+    lru_node_t* first = node_at(cache, *hand);
+    node->next = *hand;
+    node->prev = first->prev;
+    node_at(cache, first->prev)->next = index;
+    first->prev = index;
+}
+
+static void ring_remove(cache_t* cache, uint32_t* hand, uint32_t index) {
+    lru_node_t* node = node_at(cache, index);
+    if (node->next == index) {
+        *hand = NIL;
+        return;
+    }
+    node_at(cache, node->prev)->next = node->next;
+    node_at(cache, node->next)->prev = node->prev;
+    if (*hand == index) *hand = node->next;
+}
+
+// 转动 hand，清除沿途的访问位，返回第一个访问位为0的节点
+static uint32_t ring_victim(cache_t* cache, uint32_t* hand) {
+    for (;;) {
+        lru_node_t* node = node_at(cache, *hand);
+        if (!node->ref) return *hand;
+        node->ref = 0;
+        *hand = node->next;
+    }
+}
+
+// 候选者与主区的淘汰者比较频率，频率低者被淘汰
+static bool tinylfu_admit_candidate(cache_t* cache, uint32_t candidate, uint32_t victim) {
+    if (sketch_estimate(cache, node_at(cache, candidate)->hash) > sketch_estimate(cache, node_at(cache, victim)->hash)) {
+        return true;
+    }
+    ++cache->stats.rejected;
+    return false;
+}
+
+static void tinylfu_move_to_main(cache_t* cache, uint32_t candidate) {
+    uint32_t size = chunk_size(cache, candidate);
+    lru_node_t* node = node_at(cache, candidate);
+    ring_remove(cache, &cache->window_hand, candidate);
+    cache->window_bytes -= size;
+    node->segment = SEGMENT_MAIN;
+    node->ref = 0;
+    ring_insert(cache, &cache->main_hand, candidate);
+    cache->main_bytes += size;
+}
+
+// 窗口区超出容量时选出候选者，主区已满则须通过准入过滤，候选者直接淘汰时不挤占主区
+static void tinylfu_promote(cache_t* cache) {
+    uint32_t candidate = ring_victim(cache, &cache->window_hand);
+    uint32_t size = chunk_size(cache, candidate);
+    while (cache->main_hand != NIL && cache->main_bytes + size > cache->main_cap) {
+        uint32_t victim = ring_victim(cache, &cache->main_hand);
+        if (!tinylfu_admit_candidate(cache, candidate, victim)) {
+            evict_node(cache, candidate);
+            return;
         }
-        node = node->children[index];
-    }
-    node->is_end_of_word = 1;
-
-    if (node->lru_node) {
-        lru_node_t* existing_node = node->lru_node;
-        free(existing_node->value);
-        existing_node->value = strdup(value);
-        if (existing_node != cache->head) {
-            if (existing_node->prev) existing_node->prev->next = existing_node->next;
-            if (existing_node->next) existing_node->next->prev = existing_node->prev;
-            if (existing_node == cache->tail) cache->tail = existing_node->prev;
-            existing_node->next = cache->head;
-            cache->head->prev = existing_node;
-            existing_node->prev = NULL;
-            cache->head = existing_node;
+        evict_node(cache, victim);
+    }
+    tinylfu_move_to_main(cache, candidate);
+}
+
+// 新节点先进入窗口区
+static void tinylfu_admit(cache_t* cache, uint32_t index) {
+    node_at(cache, index)->segment = SEGMENT_WINDOW;
+    ring_insert(cache, &cache->window_hand, index);
+    cache->window_bytes += chunk_size(cache, index);
+    while (cache->window_bytes > cache->window_cap) {
+        tinylfu_promote(cache);
+    }
+}
+
+// 命中时只设置访问位，不改写链表
+static void tinylfu_touch(cache_t* cache, uint32_t index) {
+    node_at(cache, index)->ref = 1;
+}
+
+static void tinylfu_unlink(cache_t* cache, uint32_t index) {
+    if (node_at(cache, index)->segment == SEGMENT_WINDOW) {
+        ring_remove(cache, &cache->window_hand, index);
+        cache->window_bytes -= chunk_size(cache, index);
+    } else {
+        ring_remove(cache, &cache->main_hand, index);
+        cache->main_bytes -= chunk_size(cache, index);
+    }
+}
+
+// 分配失败时同样经过准入过滤：窗口区的候选者与主区的淘汰者中频率低者被淘汰，胜出的候选者进入主区
+static uint32_t tinylfu_victim(cache_t* cache) {
+    if (cache->main_hand == NIL) return ring_victim(cache, &cache->window_hand);
+    if (cache->window_hand == NIL) return ring_victim(cache, &cache->main_hand);
+    uint32_t candidate = ring_victim(cache, &cache->window_hand);
+    uint32_t victim = ring_victim(cache, &cache->main_hand);
+    if (!tinylfu_admit_candidate(cache, candidate, victim)) {
+        return candidate;
+    }
+    tinylfu_move_to_main(cache, candidate);
+    return victim;
+}
+
+// 先遍历主区再遍历窗口区，各自从 hand 开始
+static uint32_t tinylfu_next_oldest(cache_t* cache, uint32_t index) {
+    if (index == NIL) {
+        return cache->main_hand != NIL ? cache->main_hand : cache->window_hand;
+    }
+    lru_node_t* node = node_at(cache, index);
+    if (node->segment == SEGMENT_MAIN) {
+        if (node->next != cache->main_hand) return node->next;
+        return cache->window_hand;
+    }
+    return node->next != cache->window_hand ? node->next : NIL;
+}
+
+static const cache_policy_ops_t tinylfu_policy = {
+    "tinylfu", tinylfu_admit, tinylfu_touch, tinylfu_unlink, tinylfu_record, tinylfu_victim, tinylfu_next_oldest,
+};
+
+/* ---------------- Slab 分配器 ---------------- */
+
+static void page_list_remove(cache_t* cache, uint32_t* head, uint32_t index) {
+    slab_page_t* page = &cache->pages[index];
+    if (page->prev != NIL) cache->pages[page->prev].next = page->next;
+    else *head = page->next;
+    if (page->next != NIL) cache->pages[page->next].prev = page->prev;
+}
+
+static void page_list_push(cache_t* cache, uint32_t* head, uint32_t index) {
+    slab_page_t* page = &cache->pages[index];
+    page->prev = NIL;
+    page->next = *head;
+    if (*head != NIL) cache->pages[*head].prev = index;
+    *head = index;
+}
+
+// 为大小类别取一个空页并切分成块，没有空页时返回 NIL
+static uint32_t slab_new_page(cache_t* cache, int cls) {
+    uint32_t index = cache->free_pages;
+    if (index != NIL) {
+        page_list_remove(cache, &cache->free_pages, index);
+    } else if (cache->next_page < cache->npages) {
+        index = cache->next_page++;
+    } else {
+        return NIL;
+    }
+
+    slab_page_t* page = &cache->pages[index];
+    uint32_t stride = cache->classes[cls].size / CHUNK_ALIGN;
+    uint32_t first = index << CHUNKS_SHIFT;
+    uint32_t count = PAGE_SIZE / cache->classes[cls].size;
+    page->free = NIL;
+    for (uint32_t i = count; i-- > 0; ) {
+        lru_node_t* node = node_at(cache, first + i * stride);
+        node->hash = EMPTY_HASH;
+        node->cls = (uint8_t)cls;
+        node->next = page->free;
+        page->free = first + i * stride;
+    }
+    page->used = 0;
+    page->cls = (uint8_t)cls;
+    page_list_push(cache, &cache->classes[cls].partial, index);
+    return index;
+}
+
+static uint32_t slab_alloc(cache_t* cache, int cls) {
+    slab_class_t* c = &cache->classes[cls];
+    uint32_t index = c->partial;
+    if (index == NIL && (index = slab_new_page(cache, cls)) == NIL) {
+        return NIL;
+    }
+    slab_page_t* page = &cache->pages[index];
+    uint32_t chunk = page->free;
+    page->free = node_at(cache, chunk)->next;
+    page->used++;
+    if (page->free == NIL) {
+        page_list_remove(cache, &c->partial, index);
+    }
+    cache->used_bytes += c->size;
+    return chunk;
+}
+
+// 释放块，页清空后归还给空闲页链表，供任意大小类别使用
+static void slab_free(cache_t* cache, uint32_t chunk) {
+    uint32_t index = chunk >> CHUNKS_SHIFT;
+    slab_page_t* page = &cache->pages[index];
+    slab_class_t* c = &cache->classes[page->cls];
+    lru_node_t* node = node_at(cache, chunk);
+    node->hash = EMPTY_HASH;
+    if (page->free == NIL) {
+        page_list_push(cache, &c->partial, index);
+    }
+    node->next = page->free;
+    page->free = chunk;
+    cache->used_bytes -= c->size;
+    if (--page->used == 0) {
+        page_list_remove(cache, &c->partial, index);
+        page_list_push(cache, &cache->free_pages, index);
+    }
+}
+
+// 能容纳 size 字节的最小大小类别，超过一页时返回-1
+static int slab_class_of(cache_t* cache, size_t size) {
+    for (int i = 0; i < cache->nclasses; ++i) {
+        if (cache->classes[i].size >= size) return i;
+    }
+    return -1;
+}
+
+// 淘汰整页中的所有条目
+static void slab_reclaim_page(cache_t* cache, uint32_t index) {
+    uint32_t stride = cache->classes[cache->pages[index].cls].size / CHUNK_ALIGN;
+    uint32_t count = PAGE_SIZE / cache->classes[cache->pages[index].cls].size;
+    uint32_t first = index << CHUNKS_SHIFT;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (node_at(cache, first + i * stride)->hash != EMPTY_HASH) {
+            evict_node(cache, first + i * stride);
         }
-        return;
     }
+}
 
-    lru_node_t* lru_node = create_lru_node(key, value);
-    node->lru_node = lru_node;
-    if (cache->size == cache->capacity) {
-        lru_node_t* tail = cache->tail;
-        cache->tail = tail->prev;
-        if (cache->tail) cache->tail->next = NULL;
-        trie_node_t* del_node = cache->root;
-        int del_len = strlen(tail->key);
-        for (int i = 0; i < del_len; ++i) {
-            int index = char_to_index(tail->key[i]);
-            if (index == -1) continue;
-            del_node = del_node->children[index];
+// 分配块，没有可用的块时按淘汰策略释放内存；淘汰的条目迟迟腾不出该类别的块时，整页回收
+static uint32_t alloc_chunk(cache_t* cache, int cls) {
+    for (int evicted = 0; ; ++evicted) {
+        uint32_t chunk = slab_alloc(cache, cls);
+        if (chunk != NIL || cache->size == 0) {
+            return chunk;
         }
-        if (del_node) del_node->lru_node = NULL;
-        free(tail->key);
-        free(tail->value);
-        free(tail);
-        cache->size--;
-    }
-    lru_node->next = cache->head;
-    if (cache->head) cache->head->prev = lru_node;
-    cache->head = lru_node;
-    if (cache->tail == NULL) cache->tail = lru_node;
-    cache->size++;
+        uint32_t victim = cache->policy->victim(cache);
+        if (evicted < RECLAIM_AFTER) {
+            evict_node(cache, victim);
+        } else {
+            slab_reclaim_page(cache, victim >> CHUNKS_SHIFT);
+        }
+    }
+}
+
+/* ---------------- 缓存 ---------------- */
+
+// 删除节点，其块归还给分配器
+static void remove_node(cache_t* cache, uint32_t index) {
+    lru_node_t* node = node_at(cache, index);
+    remove_slot(cache, find_slot(cache, node->data, node->hash));
+    cache->policy->unlink(cache, index);
+    slab_free(cache, index);
+    cache->size--;
+}
+
+static void evict_node(cache_t* cache, uint32_t index) {
+    remove_node(cache, index);
+    cache->stats.evictions++;
+}
+
+// 写入节点的键和值，键的长度不变
+static void set_node_data(lru_node_t* node, const char* key, int keylen, const void* value, int len) {
+    node->keylen = (uint16_t)keylen;
+    memcpy(node->data, key, keylen + 1);
+    char* dst = node_value(node);
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+    node->len = len;
+}
+
+int cache_policy_from_name(const char* name) {
+    if (strcasecmp(name, lru_policy.name) == 0) return CACHE_POLICY_LRU;
+    if (strcasecmp(name, tinylfu_policy.name) == 0) return CACHE_POLICY_TINYLFU;
+    return -1;
+}
+
+// Cache functions
+cache_t* cache_create(size_t budget, cache_policy_e policy) {
+    if (budget < CACHE_MIN_BUDGET) budget = CACHE_MIN_BUDGET;
+    cache_t* cache = (cache_t*)calloc(1, sizeof(cache_t));
+    cache->policy = policy == CACHE_POLICY_TINYLFU ? &tinylfu_policy : &lru_policy;
+
+    // 哈希表占预算的 1/16 到 1/8，负载因子不超过 0.75，平均条目不小于 64 字节时不会先于内存达到上限
+    uint32_t nslots = 2;
+    while ((size_t)nslots * 2 * sizeof(slot_t) <= budget / 8) nslots <<= 1;
+    cache->slots = (slot_t*)malloc(sizeof(slot_t) * nslots);
+    for (uint32_t i = 0; i < nslots; ++i) {
+        cache->slots[i].hash = EMPTY_HASH;
+        cache->slots[i].node = NIL;
+    }
+    cache->mask = nslots - 1;
+    cache->max_entries = nslots / 4 * 3;
+    cache->overhead_bytes = sizeof(cache_t) + sizeof(slot_t) * nslots;
+
+    if (cache->policy == &tinylfu_policy) {
+        // 每个计数器1字节，每行计数器数约为条目数上限
+        cache->sketch_bits = 6;
+        while ((1u << cache->sketch_bits) < (uint32_t)cache->max_entries) ++cache->sketch_bits;
+        size_t sketch_bytes = (size_t)SKETCH_DEPTH << cache->sketch_bits;
+        cache->sketch = (uint8_t*)calloc(sketch_bytes, 1);
+        cache->sketch_sample = (uint32_t)cache->max_entries * 10;
+        cache->overhead_bytes += sketch_bytes;
+    }
+
+    // 剩余预算全部用于 slab 页；内存区只预留地址空间，页在首次使用时才驻留
+    size_t remain = budget > cache->overhead_bytes ? budget - cache->overhead_bytes : 0;
+    cache->npages = MAX(1, remain / (PAGE_SIZE + sizeof(slab_page_t)));
+    // 节点下标为32位，内存区不超过 64 GiB
+    cache->npages = MIN(cache->npages, (UINT32_MAX >> CHUNKS_SHIFT) - 1);
+    cache->pages = (slab_page_t*)malloc(sizeof(slab_page_t) * cache->npages);
+    cache->overhead_bytes += sizeof(slab_page_t) * cache->npages;
+    cache->arena = (char*)malloc((size_t)cache->npages * PAGE_SIZE);
+    cache->free_pages = NIL;
+
+    double size = MIN_CHUNK;
+    while (cache->nclasses < MAX_CLASSES - 1 && size < PAGE_SIZE) {
+        uint32_t aligned = ((uint32_t)size + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+        if (cache->nclasses == 0 || aligned > cache->classes[cache->nclasses - 1].size) {
+            cache->classes[cache->nclasses++].size = aligned;
+        }
+        size *= CLASS_FACTOR;
+    }
+    cache->classes[cache->nclasses++].size = PAGE_SIZE;
+    for (int i = 0; i < cache->nclasses; ++i) {
+        cache->classes[i].partial = NIL;
+    }
+
+    cache->head = cache->tail = NIL;
+    cache->window_hand = cache->main_hand = NIL;
+    size_t arena_bytes = (size_t)cache->npages * PAGE_SIZE;
+    cache->window_cap = MAX(PAGE_SIZE, arena_bytes * WINDOW_PERCENT / 100);
+    cache->main_cap = arena_bytes > cache->window_cap ? arena_bytes - cache->window_cap : PAGE_SIZE;
+
+    cache->stats.policy = cache->policy->name;
+    cache->stats.capacity = cache->max_entries;
+    cache->stats.budget = budget;
+    return cache;
+}
+
+void cache_destroy(cache_t* cache) {
+    free(cache->arena);
+    free(cache->pages);
+    free(cache->slots);
+    free(cache->sketch);
+    free(cache);
 }
 
-const char* cache_get(cache_t* cache, const char* key) {
-    trie_node_t* node = cache->root;
-    int length = strlen(key);
-    for (int i = 0; i < length; ++i) {
-        int index = char_to_index(key[i]);
-        if (index == -1) continue;
-        if (node->children[index] == NULL) {
-            return NULL;
+void cache_insert(cache_t* cache, const char* key, const void* value, int len, uint64_t expire) {
+    int keylen = strlen(key);
+    int cls = slab_class_of(cache, sizeof(lru_node_t) + ((keylen + 1 + 7) & ~7) + len + 1);
+    if (cls < 0 || keylen > UINT16_MAX) {
+        return;
+    }
+    uint32_t hash = hash_key(key);
+    uint32_t pos = find_slot(cache, key, hash);
+    if (pos != NIL) {
+        uint32_t index = cache->slots[pos].node;
+        lru_node_t* existing_node = node_at(cache, index);
+        if (existing_node->cls == cls) {
+            set_node_data(existing_node, key, keylen, value, len);
+            existing_node->expire = expire;
+            cache->policy->touch(cache, index);
+            return;
         }
-        node = node->children[index];
+        // 大小类别变化，换一个块重新插入
+        remove_node(cache, index);
+    }
+
+    while (cache->size >= cache->max_entries) {
+        evict_node(cache, cache->policy->victim(cache));
+    }
+    uint32_t index = alloc_chunk(cache, cls);
+    if (index == NIL) {
+        return;
     }
-    if (!node->is_end_of_word || !node->lru_node) {
+    lru_node_t* node = node_at(cache, index);
+    set_node_data(node, key, keylen, value, len);
+    node->expire = expire;
+    node->hash = hash;
+    node->ref = 0;
+    insert_slot(cache, hash, index);
+    cache->size++;
+    cache->policy->admit(cache, index);
+}
+
+char* cache_get(cache_t* cache, const char* key, int* len, uint64_t* expire) {
+    uint32_t hash = hash_key(key);
+    if (cache->policy->record) {
+        cache->policy->record(cache, hash);
+    }
+    uint32_t pos = find_slot(cache, key, hash);
+    if (pos == NIL) {
+        cache->stats.misses++;
         return NULL;
     }
 
-    lru_node_t* lru_node = node->lru_node;
-    if (lru_node == cache->head) {
-        return lru_node->value;
+    uint32_t index = cache->slots[pos].node;
+    lru_node_t* lru_node = node_at(cache, index);
+    if (len) *len = lru_node->len;
+    if (expire) *expire = lru_node->expire;
+    cache->policy->touch(cache, index);
+    cache->stats.hits++;
+    return node_value(lru_node);
+}
+
+void cache_get_stats(cache_t* cache, cache_stats_t* stats) {
+    *stats = cache->stats;
+    stats->size = cache->size;
+    stats->used = cache->used_bytes;
+    // 用过的页都已驻留内存，清空后也不会归还给系统
+    stats->memory = cache->overhead_bytes + (size_t)cache->next_page * PAGE_SIZE;
+}
+
+// 快照文件格式：文件头之后依次是各条目，条目按从旧到新的顺序保存，加载时按相同顺序插入以恢复 LRU 顺序
+#define SNAPSHOT_MAGIC      "DNSRCACH"
+#define SNAPSHOT_VERSION    3
+#define SNAPSHOT_HASH_INIT  14695981039346656037ull
+#define SNAPSHOT_HASH_PRIME 1099511628211ull
+
+typedef struct snapshot_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;     // 条目数
+    int64_t saved_at;   // 保存时的系统时间 (s)
+    uint64_t checksum;  // 文件头之后所有字节的校验和
+} snapshot_header_t;
+
+// 条目头，之后是 keylen 字节的键和 len 字节的值
+typedef struct snapshot_entry_t {
+    int64_t ttl;        // 保存时的剩余生存时间 (ms)，可能为负
+    uint32_t len;
+    uint16_t keylen;
+} snapshot_entry_t;
+
+#define SNAPSHOT_ENTRY_SIZE (8 + 4 + 2)
+
+// FNV-1a，可以分段累加
+static uint64_t snapshot_checksum(uint64_t hash, const void* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ ((const uint8_t*)data)[i]) * SNAPSHOT_HASH_PRIME;
+    }
+    return hash;
+}
+
+int cache_snapshot(cache_t* cache, uint64_t now, cache_snapshot_t* snapshot) {
+    // 先计算大小，一次分配
+    size_t len = sizeof(snapshot_header_t);
+    for (uint32_t index = cache->policy->next_oldest(cache, NIL); index != NIL;
+         index = cache->policy->next_oldest(cache, index)) {
+        lru_node_t* node = node_at(cache, index);
+        if (node->expire == 0) continue;
+        len += SNAPSHOT_ENTRY_SIZE + node->keylen + node->len;
+    }
+    char* data = (char*)malloc(len);
+    if (data == NULL) {
+        return -1;
     }
 
-    if (lru_node->prev) lru_node->prev->next = lru_node->next;
-    if (lru_node->next) lru_node->next->prev = lru_node->prev;
-    if (lru_node == cache->tail) cache->tail = lru_node->prev;
+    uint32_t count = 0;
+    size_t off = sizeof(snapshot_header_t);
+    for (uint32_t index = cache->policy->next_oldest(cache, NIL); index != NIL;
+         index = cache->policy->next_oldest(cache, index)) {
+        lru_node_t* node = node_at(cache, index);
+        // 永不过期的条目来自配置文件，启动时会重新加载
+        if (node->expire == 0) continue;
+        snapshot_entry_t entry;
+        entry.ttl = (int64_t)node->expire - (int64_t)now;
+        entry.len = node->len;
+        entry.keylen = node->keylen;
+        memcpy(data + off, &entry.ttl, 8);
+        memcpy(data + off + 8, &entry.len, 4);
+        memcpy(data + off + 12, &entry.keylen, 2);
+        off += SNAPSHOT_ENTRY_SIZE;
+        memcpy(data + off, node->data, entry.keylen);
+        off += entry.keylen;
+        memcpy(data + off, node_value(node), node->len);
+        off += node->len;
+        ++count;
+    }
 
-    lru_node->next = cache->head;
-    if (cache->head) cache->head->prev = lru_node;
-    cache->head = lru_node;
-    lru_node->prev = NULL;
-    if (cache->tail == NULL) cache->tail = lru_node;
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.count = count;
+    header.saved_at = (int64_t)time(NULL);
+    header.checksum = snapshot_checksum(SNAPSHOT_HASH_INIT, data + sizeof(header), len - sizeof(header));
+    memcpy(data, &header, sizeof(header));
 
-    return lru_node->value;
+    snapshot->data = data;
+    snapshot->len = len;
+    snapshot->count = (int)count;
+    return 0;
+}
+
+int cache_snapshot_write(const cache_snapshot_t* snapshot, const char* filename) {
+    char tmpname[1024];
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    FILE* file = fopen(tmpname, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    fwrite(snapshot->data, 1, snapshot->len, file);
+    if (ferror(file) | fclose(file)) {
+        remove(tmpname);
+        return -1;
+    }
+#ifdef OS_WIN
+    remove(filename);
+#endif
+    if (rename(tmpname, filename) != 0) {
+        remove(tmpname);
+        return -1;
+    }
+    return snapshot->count;
+}
+
+void cache_snapshot_free(cache_snapshot_t* snapshot) {
+    SAFE_FREE(snapshot->data);
+    snapshot->len = 0;
+    snapshot->count = 0;
+}
+
+int cache_save(cache_t* cache, const char* filename, uint64_t now) {
+    cache_snapshot_t snapshot;
+    if (cache_snapshot(cache, now, &snapshot) != 0) {
+        return -1;
+    }
+    int saved = cache_snapshot_write(&snapshot, filename);
+    cache_snapshot_free(&snapshot);
+    return saved;
+}
+
+// 解析已读入内存的快照
+static int load_snapshot(cache_t* cache, const char* data, size_t size, uint64_t now, uint64_t min_expire) {
+    snapshot_header_t header;
+    if (size < sizeof(header)) return -1;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+        return -1;
+    }
+    // 写入中断或损坏的快照整体丢弃，不加载其中任何条目
+    if (snapshot_checksum(SNAPSHOT_HASH_INIT, data + sizeof(header), size - sizeof(header)) != header.checksum) {
+        return -1;
+    }
+    // 停机期间流逝的时间
+    int64_t elapsed = ((int64_t)time(NULL) - header.saved_at) * 1000;
+    if (elapsed < 0) elapsed = 0;
+
+    int loaded = 0;
+    size_t off = sizeof(header);
+    char key[1024];
+    for (uint32_t i = 0; i < header.count; ++i) {
+        snapshot_entry_t entry;
+        if (off + SNAPSHOT_ENTRY_SIZE > size) return -1;
+        memcpy(&entry.ttl, data + off, 8);
+        memcpy(&entry.len, data + off + 8, 4);
+        memcpy(&entry.keylen, data + off + 12, 2);
+        off += SNAPSHOT_ENTRY_SIZE;
+        if (entry.keylen >= sizeof(key) || off + entry.keylen + entry.len > size) return -1;
+        int64_t expire = (int64_t)now + entry.ttl - elapsed;
+        if (expire > 0 && (uint64_t)expire >= min_expire) {
+            memcpy(key, data + off, entry.keylen);
+            key[entry.keylen] = '\0';
+            cache_insert(cache, key, data + off + entry.keylen, entry.len, expire);
+            ++loaded;
+        }
+        off += entry.keylen + entry.len;
+    }
+    return loaded;
+}
+
+int cache_load(cache_t* cache, const char* filename, uint64_t now, uint64_t min_expire) {
+#ifdef OS_UNIX
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    int loaded = load_snapshot(cache, (const char*)data, st.st_size, now, min_expire);
+    munmap(data, st.st_size);
+    return loaded;
+#else
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = size > 0 ? (char*)malloc(size) : NULL;
+    int loaded = -1;
+    if (data != NULL && fread(data, 1, size, file) == (size_t)size) {
+        loaded = load_snapshot(cache, data, size, now, min_expire);
+    }
+    free(data);
+    fclose(file);
+    return loaded;
+#endif
 }
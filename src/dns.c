@@ -2,6 +2,7 @@
 #include <hv/hdef.h>
 #include <hv/hsocket.h>
 #include <hv/herr.h>
+#include <ctype.h>
 
 
 /**
@@ -76,38 +77,101 @@ int dns_name_decode(const char* buf, char* domain) {
     return buflen;
 }
 
+/**
+ * @brief 打包域名，能压缩时用指针指向报文中已写出的相同后缀
+ *
+ * @param name 域名，例如 www.example.com，末尾的点可有可无；根域为 "." 或空字符串
+ * @param buf 报文
+ * @param len 缓冲区长度
+ * @param off 写入的偏移
+ * @param comp 名称压缩表，为 NULL 时不压缩
+ * @return 成功时返回写入的长度，缓冲区不足或域名不合法时返回-1
+ */
+static int pack_name(const char* name, char* buf, int len, int off, dns_compress_t* comp) {
+    int pos = off;
+    // 根域只有一个点，编码为单个0字节
+    const char* p = strcmp(name, ".") == 0 ? name + 1 : name;
+    while (*p != '\0') {
+        if (comp != NULL) {
+            for (int i = 0; i < comp->n; ++i) {
+                if (strcasecmp(comp->names[i], p) == 0) {
+                    if (pos + 2 > len) return -1;
+                    buf[pos] = (char)(0xC0 | (comp->offs[i] >> 8));
+                    buf[pos + 1] = (char)comp->offs[i];
+                    return pos + 2 - off;
+                }
+            }
+        }
+        // 还原 unpack_name 写出的转义
+        char label[63];
+        int n = 0;
+        const char* q = p;
+        while (*q != '\0' && *q != '.') {
+            int c = (uint8_t)*q++;
+            if (c == '\\') {
+                if (isdigit((unsigned char)q[0]) && isdigit((unsigned char)q[1]) && isdigit((unsigned char)q[2])) {
+                    c = (q[0] - '0') * 100 + (q[1] - '0') * 10 + (q[2] - '0');
+                    if (c > 255) return -1;
+                    q += 3;
+                } else if (*q != '\0') {
+                    c = (uint8_t)*q++;
+                } else {
+                    return -1;
+                }
+            }
+            if (n == (int)sizeof(label)) return -1;
+            label[n++] = (char)c;
+        }
+        if (n == 0) return -1;
+        if (pos + 1 + n > len) return -1;
+        // 指针只有14位，之后的后缀不再作为压缩目标
+        if (comp != NULL && comp->n < DNS_COMPRESS_MAX && pos < 0x4000) {
+            comp->names[comp->n] = p;
+            comp->offs[comp->n] = (uint16_t)pos;
+            ++comp->n;
+        }
+        buf[pos] = (char)n;
+        memcpy(buf + pos + 1, label, n);
+        pos += 1 + n;
+        p = *q == '.' ? q + 1 : q;
+    }
+    if (pos + 1 > len) return -1;
+    buf[pos++] = '\0';
+    return pos - off;
+}
+
 /**
  * @brief 打包DNS资源记录
  *
  * @param rr 输入的DNS资源记录
- * @param buf 输出的缓冲区
+ * @param buf 报文
  * @param len 缓冲区长度
- * @return 成功时返回打包后的长度
+ * @param off 写入的偏移
+ * @param comp 名称压缩表，为 NULL 时不压缩
+ * @return 成功时返回写入的长度
  */
-int dns_rr_pack(dns_rr_t* rr, char* buf, int len) {
-    char* p = buf;
-    char encoded_name[256];
-    int encoded_namelen = dns_name_encode(rr->name, encoded_name);
-    int packetlen = encoded_namelen + 2 + 2 + (rr->data ? (4+2+rr->datalen) : 0);
-    if (len < packetlen) {
+int dns_rr_pack(dns_rr_t* rr, char* buf, int len, int off, dns_compress_t* comp) {
+    int namelen = pack_name(rr->name, buf, len, off, comp);
+    if (namelen < 0) return -1;
+    int packetlen = namelen + 2 + 2 + (rr->data ? (4+2+rr->datalen) : 0);
+    if (len - off < packetlen) {
         return -1;
     }
 
-    memcpy(p, encoded_name, encoded_namelen);
-    p += encoded_namelen;
-    uint16_t* pushort = (uint16_t*)p;
-    *pushort = htons(rr->rtype);
+    char* p = buf + off + namelen;
+    uint16_t u16 = htons(rr->rtype);
+    memcpy(p, &u16, 2);
     p += 2;
-    pushort = (uint16_t*)p;
-    *pushort = htons(rr->rclass);
+    u16 = htons(rr->rclass);
+    memcpy(p, &u16, 2);
     p += 2;
 
-    if (rr->datalen && rr->data) {
-        uint32_t* puint = (uint32_t*)p;
-        *puint = htonl(rr->ttl);
+    if (rr->data) {
+        uint32_t u32 = htonl(rr->ttl);
+        memcpy(p, &u32, 4);
         p += 4;
-        pushort = (uint16_t*)p;
-        *pushort = htons(rr->datalen);
+        u16 = htons(rr->datalen);
+        memcpy(p, &u16, 2);
         p += 2;
         memcpy(p, rr->data, rr->datalen);
         p += rr->datalen;
@@ -115,52 +179,114 @@ int dns_rr_pack(dns_rr_t* rr, char* buf, int len) {
     return packetlen;
 }
 
+/**
+ * @brief 解码或校验报文中的一个域名
+ *
+ * 压缩指针只能指向它自身之前的位置，且域名编码后不超过255字节，因此跟随指针一定会终止。
+ * 标签中的 '.' 和 '\\' 写为 "\\." 和 "\\\\"，不可打印的字节写为 "\\DDD" (RFC 1035 5.1)，
+ * 因此不同的域名解码后一定不同，例如标签 "shop.bank" 不会与两个标签 shop、bank 混淆，解码结果可以直接用作缓存键。
+ *
+ * @param buf 报文
+ * @param len 报文长度
+ * @param off 域名的偏移
+ * @param name 输出的域名，为 NULL 时只校验
+ * @param size name 的大小
+ * @param next 输出域名在原位置占用的字节之后的偏移
+ * @return 成功时返回域名的长度，不合法时返回-1
+ */
+static int unpack_name(const char* buf, int len, int off, char* name, int size, int* next) {
+    int pos = off;
+    int encoded = 1;    // 编码后的长度，包括最后的0
+    int namelen = 0;
+    *next = -1;
+    for (;;) {
+        if (pos >= len) return -1;
+        uint8_t label = (uint8_t)buf[pos];
+        if (label == 0) break;
+        if (label >= 192) {
+            if (pos + 2 > len) return -1;
+            int ptr = ((label & 0x3F) << 8) | (uint8_t)buf[pos + 1];
+            if (ptr >= pos) return -1;
+            if (*next < 0) *next = pos + 2;
+            pos = ptr;
+            continue;
+        }
+        if (label > 63) return -1; // 扩展标签类型，不支持
+        encoded += 1 + label;
+        if (encoded > 255 || pos + 1 + label > len) return -1;
+        if (namelen > 0) {
+            if (name != NULL && namelen + 1 >= size) return -1;
+            if (name != NULL) name[namelen] = '.';
+            ++namelen;
+        }
+        for (int i = 1; i <= label; ++i) {
+            uint8_t c = (uint8_t)buf[pos + i];
+            char escaped[4];
+            int n = 1;
+            escaped[0] = (char)c;
+            if (c == '.' || c == '\\') {
+                escaped[0] = '\\';
+                escaped[1] = (char)c;
+                n = 2;
+            } else if (c <= ' ' || c >= 0x7F) {
+                escaped[0] = '\\';
+                escaped[1] = (char)('0' + c / 100);
+                escaped[2] = (char)('0' + c / 10 % 10);
+                escaped[3] = (char)('0' + c % 10);
+                n = 4;
+            }
+            if (name != NULL) {
+                if (namelen + n >= size) return -1;
+                memcpy(name + namelen, escaped, n);
+            }
+            namelen += n;
+        }
+        pos += 1 + label;
+    }
+    if (*next < 0) *next = pos + 1;
+    if (name != NULL) {
+        if (size < 1) return -1;
+        name[namelen] = '\0';
+    }
+    return namelen;
+}
+
 /**
  * @brief 解包DNS资源记录
  *
- * @param buf 输入的缓冲区
- * @param len 缓冲区长度
+ * @param buf 报文
+ * @param len 报文长度
+ * @param off 记录的偏移
  * @param rr 输出的DNS资源记录
  * @param is_question 是否是查询
- * @return 成功时返回解包后的长度
+ * @return 成功时返回记录的长度
  */
-int dns_rr_unpack(char* buf, int len, dns_rr_t* rr, int is_question) {
-    char* p = buf;
-    int off = 0;
-    int namelen = 0;
-    if (*(uint8_t*)p >= 192) {
-        namelen = 2; // 名称偏移，忽略
-    } else {
-        namelen = dns_name_decode(buf, rr->name);
-    }
-    if (namelen < 0) return -1;
-    p += namelen;
-    off += namelen;
+int dns_rr_unpack(char* buf, int len, int off, dns_rr_t* rr, int is_question) {
+    int start = off;
+    if (unpack_name(buf, len, off, rr->name, sizeof(rr->name), &off) < 0) return -1;
 
     if (len < off + 4) return -1;
-    uint16_t* pushort = (uint16_t*)p;
-    rr->rtype = ntohs(*pushort);
-    p += 2;
-    pushort = (uint16_t*)p;
-    rr->rclass = ntohs(*pushort);
-    p += 2;
+    uint16_t u16;
+    memcpy(&u16, buf + off, 2);
+    rr->rtype = ntohs(u16);
+    memcpy(&u16, buf + off + 2, 2);
+    rr->rclass = ntohs(u16);
     off += 4;
 
     if (!is_question) {
         if (len < off + 6) return -1;
-        uint32_t* puint = (uint32_t*)p;
-        rr->ttl = ntohl(*puint);
-        p += 4;
-        pushort = (uint16_t*)p;
-        rr->datalen = ntohs(*pushort);
-        p += 2;
+        uint32_t u32;
+        memcpy(&u32, buf + off, 4);
+        rr->ttl = ntohl(u32);
+        memcpy(&u16, buf + off + 4, 2);
+        rr->datalen = ntohs(u16);
         off += 6;
         if (len < off + rr->datalen) return -1;
-        rr->data = p;
-        p += rr->datalen;
+        // 数据中的域名 (例如 CNAME 的目标) 保持原样，其中的压缩指针相对于报文起始
+        rr->data = buf + off;
         off += rr->datalen;
     }
-    return off;
+    return off - start;
 }
 
 /**
@@ -183,24 +309,27 @@ int dns_pack(dns_t* dns, char* buf, int len) {
     htonhdr.naddtional = htons(hdr->naddtional);
     memcpy(buf, &htonhdr, sizeof(dnshdr_t));
     off += sizeof(dnshdr_t);
+    // 所有记录共用一个压缩表，相同的域名后缀只写出一次
+    dns_compress_t comp;
+    comp.n = 0;
     int i;
     for (i = 0; i < hdr->nquestion; ++i) {
-        int packetlen = dns_rr_pack(dns->questions+i, buf+off, len-off);
+        int packetlen = dns_rr_pack(dns->questions+i, buf, len, off, &comp);
         if (packetlen < 0) return -1;
         off += packetlen;
     }
     for (i = 0; i < hdr->nanswer; ++i) {
-        int packetlen = dns_rr_pack(dns->answers+i, buf+off, len-off);
+        int packetlen = dns_rr_pack(dns->answers+i, buf, len, off, &comp);
         if (packetlen < 0) return -1;
         off += packetlen;
     }
     for (i = 0; i < hdr->nauthority; ++i) {
-        int packetlen = dns_rr_pack(dns->authorities+i, buf+off, len-off);
+        int packetlen = dns_rr_pack(dns->authorities+i, buf, len, off, &comp);
         if (packetlen < 0) return -1;
         off += packetlen;
     }
     for (i = 0; i < hdr->naddtional; ++i) {
-        int packetlen = dns_rr_pack(dns->addtionals+i, buf+off, len-off);
+        int packetlen = dns_rr_pack(dns->addtionals+i, buf, len, off, &comp);
         if (packetlen < 0) return -1;
         off += packetlen;
     }
@@ -232,7 +361,7 @@ int dns_unpack(char* buf, int len, dns_t* dns) {
         int bytes = hdr->nquestion * sizeof(dns_rr_t);
         SAFE_ALLOC(dns->questions, bytes);
         for (i = 0; i < hdr->nquestion; ++i) {
-            int packetlen = dns_rr_unpack(buf+off, len-off, dns->questions+i, 1);
+            int packetlen = dns_rr_unpack(buf, len, off, dns->questions+i, 1);
             if (packetlen < 0) return -1;
             off += packetlen;
         }
@@ -241,7 +370,7 @@ int dns_unpack(char* buf, int len, dns_t* dns) {
         int bytes = hdr->nanswer * sizeof(dns_rr_t);
         SAFE_ALLOC(dns->answers, bytes);
         for (i = 0; i < hdr->nanswer; ++i) {
-            int packetlen = dns_rr_unpack(buf+off, len-off, dns->answers+i, 0);
+            int packetlen = dns_rr_unpack(buf, len, off, dns->answers+i, 0);
             if (packetlen < 0) return -1;
             off += packetlen;
         }
@@ -250,7 +379,7 @@ int dns_unpack(char* buf, int len, dns_t* dns) {
         int bytes = hdr->nauthority * sizeof(dns_rr_t);
         SAFE_ALLOC(dns->authorities, bytes);
         for (i = 0; i < hdr->nauthority; ++i) {
-            int packetlen = dns_rr_unpack(buf+off, len-off, dns->authorities+i, 0);
+            int packetlen = dns_rr_unpack(buf, len, off, dns->authorities+i, 0);
             if (packetlen < 0) return -1;
             off += packetlen;
         }
@@ -259,7 +388,7 @@ int dns_unpack(char* buf, int len, dns_t* dns) {
         int bytes = hdr->naddtional * sizeof(dns_rr_t);
         SAFE_ALLOC(dns->addtionals, bytes);
         for (i = 0; i < hdr->naddtional; ++i) {
-            int packetlen = dns_rr_unpack(buf+off, len-off, dns->addtionals+i, 0);
+            int packetlen = dns_rr_unpack(buf, len, off, dns->addtionals+i, 0);
             if (packetlen < 0) return -1;
             off += packetlen;
         }
@@ -267,6 +396,118 @@ int dns_unpack(char* buf, int len, dns_t* dns) {
     return off;
 }
 
+/**
+ * @brief 计算报文问题部分的长度
+ *
+ * @param buf 报文
+ * @param len 报文长度
+ * @return 成功时返回问题部分长度，报文不完整时返回-1
+ */
+int dns_question_len(const char* buf, int len) {
+    int off = sizeof(dnshdr_t);
+    while (off < len) {
+        uint8_t label = (uint8_t)buf[off];
+        if (label == 0) {
+            // 与 unpack_name 相同，域名编码后不超过255字节
+            if (off + 1 - (int)sizeof(dnshdr_t) > 255) return -1;
+            off += 1 + 4;
+            return off <= len ? off - (int)sizeof(dnshdr_t) : -1;
+        }
+        // 标签最长63字节；192 及以上是压缩指针，查询中不应出现
+        if (label > 63) return -1;
+        off += 1 + label;
+    }
+    return -1;
+}
+
+int dns_name_unpack(const char* buf, int len, int off, char* name, int size) {
+    int next;
+    return unpack_name(buf, len, off, name, size, &next);
+}
+
+/**
+ * @brief 建立报文的视图
+ *
+ * @param buf 输入的缓冲区
+ * @param len 缓冲区长度
+ * @param view 输出的视图
+ * @return 成功时返回最后一条记录之后的偏移，报文不合法时返回-1
+ */
+int dns_view_parse(const char* buf, int len, dns_view_t* view) {
+    view->buf = buf;
+    view->len = len;
+    if (len < (int)sizeof(dnshdr_t)) return -1;
+    dnshdr_t* hdr = &view->hdr;
+    memcpy(hdr, buf, sizeof(dnshdr_t));
+    hdr->transaction_id = ntohs(hdr->transaction_id);
+    hdr->nquestion = ntohs(hdr->nquestion);
+    hdr->nanswer = ntohs(hdr->nanswer);
+    hdr->nauthority = ntohs(hdr->nauthority);
+    hdr->naddtional = ntohs(hdr->naddtional);
+
+    // 每条记录至少占用5字节，记录数再大也会在报文末尾处停止
+    int counts[DNS_SECTION_END] = {hdr->nquestion, hdr->nanswer, hdr->nauthority, hdr->naddtional};
+    int off = sizeof(dnshdr_t);
+    for (int section = 0; section < DNS_SECTION_END; ++section) {
+        view->sections[section] = off;
+        for (int i = 0; i < counts[section]; ++i) {
+            if (unpack_name(buf, len, off, NULL, 0, &off) < 0) return -1;
+            if (section == DNS_SECTION_QUESTION) {
+                off += 4;
+                if (off > len) return -1;
+                continue;
+            }
+            if (off + 10 > len) return -1;
+            uint16_t datalen;
+            memcpy(&datalen, buf + off + 8, 2);
+            off += 10 + ntohs(datalen);
+            if (off > len) return -1;
+        }
+    }
+    view->sections[DNS_SECTION_END] = off;
+    return off;
+}
+
+/**
+ * @brief 读取视图中的一条问题或资源记录
+ *
+ * @param view 报文视图
+ * @param off 记录的起始偏移
+ * @param is_question 是否是问题
+ * @param rr 输出的记录视图
+ * @return 下一条记录的偏移
+ */
+int dns_view_rr(const dns_view_t* view, int off, int is_question, dns_rr_view_t* rr) {
+    const char* buf = view->buf;
+    rr->name = off;
+    // 域名已在 dns_view_parse 中校验过，只需跳过
+    for (;;) {
+        uint8_t label = (uint8_t)buf[off];
+        if (label == 0) { off += 1; break; }
+        if (label >= 192) { off += 2; break; }
+        off += 1 + label;
+    }
+    uint16_t u16;
+    memcpy(&u16, buf + off, 2);
+    rr->rtype = ntohs(u16);
+    memcpy(&u16, buf + off + 2, 2);
+    rr->rclass = ntohs(u16);
+    off += 4;
+    if (is_question) {
+        rr->ttl = 0;
+        rr->datalen = 0;
+        rr->data = 0;
+        return off;
+    }
+    uint32_t u32;
+    memcpy(&u32, buf + off, 4);
+    rr->ttl = ntohl(u32);
+    memcpy(&u16, buf + off + 4, 2);
+    rr->datalen = ntohs(u16);
+    rr->data = off + 6;
+    return rr->data + rr->datalen;
+}
+
 /**
  * @brief 发送DNS查询并接收响应
  *
@@ -444,73 +685,3 @@ int nslookup6(const char* domain, uint8_t addrs[][16], int naddr, const char* na
     dns_free(&resp);
     return ret;
 }
-
-/**
- * @brief 异步发送DNS查询并接收响应
- *
- * @param query 输入的DNS查询消息
- * @param response 输出的DNS响应消息
- * @param nameserver DNS服务器地址
- * @param io 传入的hio对象
- * @param cb 查询完成后的回调函数
- * @return 成功时返回0
- */
-int dns_query_async(dns_t* query, dns_t* response, const char* nameserver, hio_t* io,
-
-        void (*cb)(hio_t *, void *, int)
-
-) {
-    char buf[1024];
-    int buflen = sizeof(buf);
-    buflen = dns_pack(query, buf, buflen);
-    if (buflen < 0) {
-        return buflen;
-    }
-
-    // 设置上下文为response结构体，用于回调时使用
-    hio_set_context(io, response);
-
-    struct sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
-    memset(&addr, 0, addrlen);
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(nameserver);
-    addr.sin_port = htons(DNS_PORT);
-
-    // 设置远端地址
-    hio_set_peeraddr(io, (struct sockaddr *) &addr, addrlen);
-
-    // 发送数据
-    hio_write(io, buf, buflen);
-
-    // 设置读取回调
-    hio_setcb_read(io, cb);
-
-    // 开始读取响应数据
-    hio_read(io);
-
-    return 0;
-}
-
-/**
- * @brief DNS响应处理回调
- *
- * @param io I/O对象
- * @param buf 缓冲区
- * @param readbytes 读取字节数
- */
-static void on_dns_response(hio_t* io, void* buf, int readbytes) {
-    dns_t* response = (dns_t*)hio_context(io);
-
-    int nparse = dns_unpack((char*)buf, readbytes, response);
-    if (nparse < 0) {
-        hloge("Failed to unpack DNS response");
-        return;
-    }
-
-    // 处理DNS响应...
-    hlogi("DNS response received");
-
-    // 停止读取
-    hio_close(io);
-}
\ No newline at end of file
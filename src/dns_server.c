@@ -1,11 +1,115 @@
 #include "dns_server.h"
+#include <ctype.h>
+#include <hv/hthread.h>
+#include <hv/htime.h>
+#ifdef OS_LINUX
+#include <sys/inotify.h>
+#endif
+
+// 等待上游应答的客户端请求
+typedef struct dns_request_s {
+    hio_t*                  io;             // 服务端 I/O 对象
+    sockaddr_u              client_addr;    // 客户端地址
+    char                    query[sizeof(dnshdr_t) + DNS_NAME_MAXLEN + 4];  // 原始报头和问题
+    int                     qlen;           // 问题部分长度
+    struct dns_request_s*   next;
+} dns_request_t;
+
+// 一次在途的上游查询，问题相同的客户端请求都挂在它上面等待同一个应答
+struct dns_flight_s {
+    dns_server_t*           server;
+    uint32_t                hash;
+    char                    name[DNS_NAME_MAXLEN];
+    uint16_t                rtype;
+    uint16_t                rclass;
+    uint8_t                 flags;          // FLIGHT_EDNS 等请求属性
+    dns_request_t*          waiters;        // 等待应答的客户端请求
+    htimer_t*               stale_timer;    // 过期应答的客户端截止时间
+    bool                    stale_served;   // 已用过期应答回复过客户端
+    uint64_t                prefetch_expire;// 预取时为被刷新条目的过期时间，否则为0
+    struct dns_flight_s*    next;           // 哈希链
+};
+
+// 后台线程中的一次规则文件重新加载
+struct dns_reload_s {
+    dns_server_t*           server;
+    hthread_t               thread;
+    dns_rules_t*            rules;          // 加载结果，失败时为 NULL
+    uint64_t                start_us;
+};
+
+// 后台线程中的一次快照写入，条目已在事件循环中序列化
+struct dns_snapshot_s {
+    dns_server_t*           server;
+    hthread_t               thread;
+    cache_snapshot_t        data;
+    int                     saved;          // 保存的条目数，失败时为-1
+    uint64_t                start_us;
+};
+
+// 在途查询键中除问题之外的请求属性，属性不同时上游应答可能不同，不合并
+#define FLIGHT_EDNS         0x01    // 带 OPT 记录
+#define FLIGHT_DO           0x02    // 要求 DNSSEC 记录 (OPT 中的 DO 位)
+#define FLIGHT_CD           0x04    // 禁用检查
+// 其中决定缓存内容的属性，也是缓存键的一部分；是否带 OPT 只影响应答能否超过512字节，而这样的应答不缓存
+#define CACHE_FLAGS         (FLIGHT_DO | FLIGHT_CD)
+
+// 本地配置的记录永不过期，应答时使用的 TTL
+#define LOCAL_TTL           3600
+// sinkhole 应答的 TTL，规则移除后客户端最多在这段时间内仍使用 0.0.0.0
+#define BLOCK_TTL           300
+// 返回过期应答时使用的 TTL (RFC 8767 建议 30 秒)
+#define STALE_TTL           30
+// 每个缓存条目最多保存的记录数
+#define MAX_CACHED_RRS      32
+// 每个缓存条目记录部分的最大长度，加上报头和问题不超过512字节
+#define CACHE_DATA_MAXLEN   (512 - 12 - 5)
+// 缓存键的最大长度，域名#类型#类
+#define CACHE_KEY_MAXLEN    (DNS_NAME_MAXLEN + 16)
+// 规则文件变化后等待的时间 (ms)，期间的多次写入只触发一次重新加载
+#define RELOAD_DELAY        200
+
+// 缓存中保存的应答，rcode 非0或没有应答记录时是否定应答
+// 记录部分是上游应答中紧跟问题之后的原始报文，其中的压缩指针只指向报头、问题和记录部分本身，
+// 而客户端问题与上游问题长度相同，因此可以直接拼接在客户端问题之后
+typedef struct {
+    uint8_t     rcode;
+    uint8_t     nttl;                       // TTL 字段数量
+    uint16_t    nanswer;
+    uint16_t    nauthority;
+    uint32_t    ttl;                        // 写入时的 TTL (s)
+    uint32_t    hits;                       // 写入后的命中次数，用于判断是否值得预取
+    uint64_t    prefetched;                 // 由预取刷新时为刷新前的过期时间，命中超过该时间后清零
+    uint16_t    ttl_offs[MAX_CACHED_RRS];   // 各 TTL 字段在 data 中的偏移
+    char        data[];                     // 应答部分，否定应答还包括权威部分
+} cached_answer_t;
 
 // 函数声明
-static int check_cache(dns_server_t* server, dns_t* query, dns_t* response);
-static void build_dns_response(dns_t* response, dns_t* query, int addr_cnt, const char* cached_value, int type);
-static int perform_dns_lookup(dns_server_t* server, dns_t* query, dns_t* response);
-static int load_blacklist(cache_t* blacklist, cache_t* cache, const char* filename);
-static bool is_blacklisted(cache_t* blacklist, const char* domain);
+static int check_cache(dns_server_t* server, const char* query, int len, int flags, char* buf, bool stale,
+                       bool* screened);
+static int perform_dns_lookup(dns_server_t* server, hio_t* io, const dns_view_t* query, const char* name,
+                              const dns_rr_view_t* question, sockaddr_u* client_addr);
+static void on_lookup_done(void* userdata, int status, char* buf, int len);
+static bool reply_stale(dns_server_t* server, dns_request_t* req, uint8_t flags);
+static int raw_query_flags(const char* query, int len, int qlen);
+static void save_snapshot(dns_server_t* server);
+static void cancel_snapshot(dns_server_t* server);
+static void on_snapshot_timer(htimer_t* timer);
+static HTHREAD_ROUTINE(snapshot_thread);
+static void on_snapshot_done(hevent_t* ev);
+static void prefetch(dns_server_t* server, const char* query, int qlen, const char* name, uint8_t flags,
+                     uint64_t expire);
+static int send_dns_response(hio_t* io, sockaddr_u* client_addr, dns_t* response);
+static void send_raw_response(hio_t* io, sockaddr_u* client_addr, const char* buf, int len);
+static void answer_server_info(dns_server_t* server, hio_t* io, sockaddr_u* client_addr, const dns_view_t* query,
+                               const char* name, const dns_rr_view_t* question);
+static void reply_query_error(hio_t* io, sockaddr_u* client_addr, const dns_view_t* query, int rcode);
+static dns_rules_t* load_rules(const char* filename);
+static void free_rules(dns_rules_t* rules);
+static bool is_blacklisted(dns_server_t* server, const char* domain);
+static void start_reload(dns_server_t* server);
+static void cancel_reload(dns_server_t* server);
+static void watch_rules(dns_server_t* server);
 /**
  * @brief 初始化DNS服务器
  *
@@ -14,7 +118,7 @@ static bool is_blacklisted(cache_t* blacklist, const char* domain);
  * @return 成功时返回0
  */
 int dns_server_init(dns_server_t* server, struct Config* config) {
-    server->loop = hloop_new(HLOOP_FLAG_AUTO_FREE);
+    server->loop = hloop_new(0);
     if (server->loop == NULL) {
         hloge("Failed to create event loop");
         return -1;
@@ -31,19 +135,50 @@ int dns_server_init(dns_server_t* server, struct Config* config) {
     hio_read(io);
 
     server->config = config;
-    server->cache = cache_create(config->cache_size);
-    server->blacklist = cache_create(config->cache_size);
-    if(load_blacklist(server->blacklist, server->cache, config->filename) != 0) {
+    int policy = cache_policy_from_name(config->cache_policy);
+    if (policy < 0) {
+        hloge("Unknown cache policy %s", config->cache_policy);
+        return -1;
+    }
+    int block_mode = block_mode_from_name(config->block_mode);
+    if (block_mode < 0) {
+        hloge("Unknown block mode %s", config->block_mode);
+        return -1;
+    }
+    block_response_init(&server->block, (block_mode_e)block_mode, BLOCK_TTL);
+    server->forwarder = forwarder_create(server->loop, config);
+    if (server->forwarder == NULL) {
+        hloge("Failed to create forwarder");
+        return -1;
+    }
+    server->cache = cache_create(config->cache_size, (cache_policy_e)policy);
+    if (config->snapshot != NULL) {
+        // 先加载快照，配置文件中的记录随后覆盖同名条目
+        hloop_update_time(server->loop);
+        uint64_t now = hloop_now_ms(server->loop);
+        uint64_t t0 = hloop_now_us(server->loop);
+        int loaded = cache_load(server->cache, config->snapshot, now, now - MIN(now, (uint64_t)config->stale_ttl * 1000));
+        hloop_update_time(server->loop);
+        if (loaded >= 0) {
+            hlogi("Loaded %d cache entries from %s in %lluus", loaded, config->snapshot,
+                  (unsigned long long)(hloop_now_us(server->loop) - t0));
+        }
+        htimer_t* timer = htimer_add(server->loop, on_snapshot_timer, config->snapshot_interval * 1000, INFINITE);
+        hevent_set_userdata(timer, server);
+    }
+    server->rules = load_rules(config->filename);
+    if (server->rules == NULL) {
         hloge("Failed to load blacklist");
         return -1;
     }
+    watch_rules(server);
 
     hlogi("DNS Server initialized on port %d", config->port);
     return 0;
 }
 
 /**
- * @brief 启动DNS服务器
+ * @brief 启动DNS服务器，事件循环停止后返回
  *
  * @param server DNS服务器实例
  * @return 成功时返回0
@@ -54,19 +189,115 @@ int dns_server_start(dns_server_t* server) {
 }
 
 /**
- * @brief 停止DNS服务器
+ * @brief 停止DNS服务器，在 dns_server_start 返回后调用
+ *
+ * 保存快照并释放所有资源，包括事件循环。
  *
  * @param server DNS服务器实例
  * @return 成功时返回0
  */
 int dns_server_stop(dns_server_t* server) {
     hlogi("DNS Server stopping...");
-    hloop_stop(server->loop);
+    hloop_update_time(server->loop);
+    cancel_snapshot(server);
+    save_snapshot(server);
+    forwarder_destroy(server->forwarder);
     cache_destroy(server->cache);
-    cache_destroy(server->blacklist);
+    cancel_reload(server);
+    free_rules(server->rules);
+    server->rules = NULL;
+    hloop_free(&server->loop);
     return 0;
 }
 
+/**
+ * @brief 将缓存保存到快照文件，在停止时调用
+ *
+ * @param server DNS服务器实例
+ */
+static void save_snapshot(dns_server_t* server) {
+    if (server->config->snapshot == NULL) {
+        return;
+    }
+    int saved = cache_save(server->cache, server->config->snapshot, hloop_now_ms(server->loop));
+    if (saved < 0) {
+        hloge("Failed to save snapshot %s", server->config->snapshot);
+    } else {
+        hlogd("Saved %d cache entries to %s", saved, server->config->snapshot);
+    }
+}
+
+static HTHREAD_ROUTINE(snapshot_thread) {
+    dns_snapshot_t* snapshot = (dns_snapshot_t*)userdata;
+    dns_server_t* server = snapshot->server;
+    snapshot->saved = cache_snapshot_write(&snapshot->data, server->config->snapshot);
+    // 回到事件循环线程中释放
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.cb = on_snapshot_done;
+    ev.userdata = server;
+    hloop_post_event(server->loop, &ev);
+    return (HTHREAD_RETTYPE)0;
+}
+
+static void on_snapshot_done(hevent_t* ev) {
+    dns_server_t* server = (dns_server_t*)hevent_userdata(ev);
+    dns_snapshot_t* snapshot = server->snapshot;
+    if (snapshot == NULL) {
+        // 服务器已停止
+        return;
+    }
+    hthread_join(snapshot->thread);
+    server->snapshot = NULL;
+    if (snapshot->saved < 0) {
+        hloge("Failed to save snapshot %s", server->config->snapshot);
+    } else {
+        hloop_update_time(server->loop);
+        hlogd("Saved %d cache entries to %s in %llums", snapshot->saved, server->config->snapshot,
+              (unsigned long long)(hloop_now_us(server->loop) - snapshot->start_us) / 1000);
+    }
+    cache_snapshot_free(&snapshot->data);
+    free(snapshot);
+}
+
+/**
+ * @brief 停止时等待进行中的写入结束，随后由 save_snapshot 写入最终的快照
+ */
+static void cancel_snapshot(dns_server_t* server) {
+    dns_snapshot_t* snapshot = server->snapshot;
+    if (snapshot == NULL) {
+        return;
+    }
+    server->snapshot = NULL;
+    hthread_join(snapshot->thread);
+    cache_snapshot_free(&snapshot->data);
+    free(snapshot);
+}
+
+/**
+ * @brief 定期保存快照
+ *
+ * 事件循环中只把条目复制到内存中，文件的写入和重命名在后台线程中进行，不阻塞查询。
+ * 上一次写入尚未完成时跳过本次。
+ */
+static void on_snapshot_timer(htimer_t* timer) {
+    dns_server_t* server = (dns_server_t*)hevent_userdata(timer);
+    if (server->snapshot != NULL) {
+        hlogw("Previous snapshot of %s is still being written, skipping", server->config->snapshot);
+        return;
+    }
+    dns_snapshot_t* snapshot = (dns_snapshot_t*)calloc(1, sizeof(dns_snapshot_t));
+    snapshot->server = server;
+    snapshot->start_us = hloop_now_us(server->loop);
+    if (cache_snapshot(server->cache, hloop_now_ms(server->loop), &snapshot->data) != 0) {
+        hloge("Failed to save snapshot %s", server->config->snapshot);
+        free(snapshot);
+        return;
+    }
+    server->snapshot = snapshot;
+    snapshot->thread = hthread_create(snapshot_thread, snapshot);
+}
+
 /**
  * @brief 接收数据回调函数
  *
@@ -75,183 +306,1147 @@ int dns_server_stop(dns_server_t* server) {
  * @param readbytes 读取字节数
  */
 static void on_recv(hio_t* io, void* buf, int readbytes) {
+    // UDP 服务端的对端地址即本次数据报的来源
     sockaddr_u client_addr;
-    socklen_t addrlen = sizeof(client_addr);
-    getpeername(hio_fd(io), (struct sockaddr*)&client_addr, &addrlen);
+    memcpy(&client_addr, hio_peeraddr(io), sizeof(client_addr));
 
-    dns_t query;
-    if (dns_unpack((char*)buf, readbytes, &query) < 0) {
-        hloge("Failed to unpack DNS query");
+    dns_server_t* server = (dns_server_t*)hio_context(io);
+    ++server->stats.queries;
+    char packet[512];
+    bool screened = false;
+    int packetlen = check_cache(server, (const char*)buf, readbytes, -1, packet, false, &screened);
+    if (packetlen > 0) {
+        // 本地区域、拦截或缓存命中，不解包直接应答
+        send_raw_response(io, &client_addr, packet, packetlen);
         return;
     }
 
-    on_dns_query(io, &query, &client_addr, addrlen);
+    // 只建立视图，不分配内存、不复制问题
+    dns_view_t query;
+    if (dns_view_parse((const char*)buf, readbytes, &query) < 0 || query.hdr.nquestion == 0) {
+        hloge("Failed to parse DNS query");
+        return;
+    }
+    on_dns_query(io, &query, &client_addr, screened);
 }
 
 /**
  * @brief 处理DNS查询
  *
+ * 只解码第一个问题的域名，放在栈上；转发、拦截和错误应答都直接使用原始报文。
+ *
  * @param io I/O对象
- * @param query DNS查询消息
+ * @param query 客户端查询报文的视图
  * @param client_addr 客户端地址
- * @param addrlen 地址长度
+ * @param screened check_cache 已查过黑名单且未匹配，不再重复查询
  */
-static void on_dns_query(hio_t* io, dns_t* query, sockaddr_u* client_addr, socklen_t addrlen) {
+static void on_dns_query(hio_t* io, const dns_view_t* query, sockaddr_u* client_addr, bool screened) {
+    dns_server_t* server = (dns_server_t*)hio_context(io);
+    dns_rr_view_t question;
+    dns_view_rr(query, query->sections[DNS_SECTION_QUESTION], 1, &question);
+    char name[DNS_NAME_MAXLEN];
+    if (dns_name_unpack(query->buf, query->len, question.name, name, sizeof(name)) < 0) {
+        return;
+    }
+
+    if (question.rclass == DNS_CLASS_CH && question.rtype == DNS_TYPE_TXT) {
+        answer_server_info(server, io, client_addr, query, name, &question);
+        return;
+    }
+
+    bool blacklisted = !screened && is_blacklisted(server, name);
+
+    if (!blacklisted && perform_dns_lookup(server, io, query, name, &question, client_addr) == 0) {
+        // 已交给转发引擎，应答在 on_lookup_done 中发送
+        return;
+    }
+
+    if(blacklisted) hlogi("Blacklisted: %s", name);
+    else    hloge("Not found: %s", name);
+    // 多个问题等无法使用模板的查询，拦截时只按应答方式设置响应码
+    reply_query_error(io, client_addr, query, blacklisted ? server->block.hdr.rcode : 3);
+}
+
+/**
+ * @brief 由客户端报文的报头和问题部分构造错误应答并发送
+ *
+ * @param io 服务端 I/O 对象
+ * @param client_addr 客户端地址
+ * @param query 客户端查询报文的视图
+ * @param rcode 响应码
+ */
+static void reply_query_error(hio_t* io, sockaddr_u* client_addr, const dns_view_t* query, int rcode) {
+    char buf[512];
+    int len = query->sections[DNS_SECTION_ANSWER];
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    if (len > (int)sizeof(buf)) {
+        // 问题部分放不下时只返回报头
+        len = sizeof(dnshdr_t);
+        memcpy(buf, query->buf, len);
+        hdr->tc = 1;
+        hdr->nquestion = 0;
+    } else {
+        memcpy(buf, query->buf, len);
+        hdr->tc = 0;
+    }
+    hdr->qr = DNS_RESPONSE;
+    hdr->aa = 0;
+    hdr->ra = 1;
+    hdr->ad = 0;
+    hdr->rcode = rcode;
+    hdr->nanswer = hdr->nauthority = hdr->naddtional = 0;
+    send_raw_response(io, client_addr, buf, len);
+}
+
+/**
+ * @brief 打包并向客户端发送应答
+ *
+ * @param io 服务端 I/O 对象
+ * @param client_addr 客户端地址
+ * @param response 应答消息
+ * @return 成功时返回0
+ */
+static int send_dns_response(hio_t* io, sockaddr_u* client_addr, dns_t* response) {
+    char buf[512];
+    int len = dns_pack(response, buf, sizeof(buf));
+    if (len < 0) {
+        hloge("Failed to pack DNS response");
+        return -1;
+    }
+    send_raw_response(io, client_addr, buf, len);
+    return 0;
+}
+
+/**
+ * @brief 向客户端发送已打包好的应答报文
+ *
+ * @param io 服务端 I/O 对象
+ * @param client_addr 客户端地址
+ * @param buf 应答报文
+ * @param len 报文长度
+ */
+static void send_raw_response(hio_t* io, sockaddr_u* client_addr, const char* buf, int len) {
+    // 异步应答时对端地址可能已被后续数据报覆盖，发送前重新设置
+    hio_set_peeraddr(io, &client_addr->sa, sockaddr_len(client_addr));
+    hio_write(io, buf, len);
+}
+
+/**
+ * @brief 设置一条 TXT 记录，text 超过255字节时分成多个字符串，读取时按顺序拼接
+ */
+static void set_txt_record(dns_rr_t* rr, const char* name, const char* text) {
+    int len = (int)strlen(text);
+    int nstrings = MAX(1, (len + 254) / 255);
+    memset(rr, 0, sizeof(dns_rr_t));
+    snprintf(rr->name, sizeof(rr->name), "%s", name);
+    rr->rtype = DNS_TYPE_TXT;
+    rr->rclass = DNS_CLASS_CH;
+    rr->datalen = len + nstrings;
+    rr->data = (char*)malloc(rr->datalen);
+    char* p = rr->data;
+    for (int off = 0; off < len || p == rr->data; off += 255) {
+        int n = MIN(len - off, 255);
+        *p++ = (char)n;
+        memcpy(p, text + off, n);
+        p += n;
+    }
+}
+
+/**
+ * @brief 填写 CHAOS 类的服务器信息查询的应答记录
+ *
+ * 支持 upstreams.dnsrelay (每个上游服务器一条 TXT 记录) 和 stats.dnsrelay (服务器计数器)，
+ * 例如 dig @127.0.0.1 upstreams.dnsrelay CH TXT
+ *
+ * @param server DNS服务器实例
+ * @param name 查询的域名
+ * @param response 应答消息
+ */
+static void fill_server_info(dns_server_t* server, const char* name, dns_t* response) {
+    response->hdr.aa = 1;
+    if (strcasecmp(name, "stats.dnsrelay") == 0) {
+        // 足够容纳所有计数器都取最大值时的一行
+        char text[512];
+        dns_server_stats_t* st = &server->stats;
+        snprintf(text, sizeof(text), "queries=%llu local_hits=%llu cache_hits=%llu negative_hits=%llu stale_hits=%llu "
+                 "prefetches=%llu prefetch_saved=%llu forwarded=%llu coalesced=%llu",
+                 (unsigned long long)st->queries, (unsigned long long)st->local_hits,
+                 (unsigned long long)st->cache_hits,
+                 (unsigned long long)st->negative_hits, (unsigned long long)st->stale_hits,
+                 (unsigned long long)st->prefetches, (unsigned long long)st->prefetch_saved,
+                 (unsigned long long)st->forwarded, (unsigned long long)st->coalesced);
+        response->answers = (dns_rr_t*)malloc(sizeof(dns_rr_t) * 3);
+        set_txt_record(&response->answers[0], name, text);
+        hlogi("Stats %s", text);
+
+        cache_stats_t cs;
+        cache_get_stats(server->cache, &cs);
+        uint64_t lookups = cs.hits + cs.misses;
+        snprintf(text, sizeof(text), "cache policy=%s size=%d/%d used=%zuKiB memory=%zu/%zuKiB hits=%llu misses=%llu "
+                 "hit_ratio=%.2f%% evictions=%llu rejected=%llu",
+                 cs.policy, cs.size, cs.capacity, cs.used >> 10, cs.memory >> 10, cs.budget >> 10,
+                 (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+                 lookups ? cs.hits * 100.0 / lookups : 0.0,
+                 (unsigned long long)cs.evictions, (unsigned long long)cs.rejected);
+        set_txt_record(&response->answers[1], name, text);
+        hlogi("Stats %s", text);
+
+        // 误判率 = 误判次数 / 实际不匹配的查询数
+        const blocklist_t* blacklist = server->rules->blacklist;
+        uint64_t negatives = st->filter_rejects + st->filter_false_positives;
+        snprintf(text, sizeof(text), "blacklist rules=%zu memory=%zuKiB blacklisted=%llu filter_rejects=%llu "
+                 "filter_false_positives=%llu filter_fpr=%.3f%%",
+                 blocklist_size(blacklist), blocklist_memory(blacklist) >> 10, (unsigned long long)st->blacklisted,
+                 (unsigned long long)st->filter_rejects, (unsigned long long)st->filter_false_positives,
+                 negatives ? st->filter_false_positives * 100.0 / negatives : 0.0);
+        set_txt_record(&response->answers[2], name, text);
+        hlogi("Stats %s", text);
+        response->hdr.nanswer = 3;
+    } else if (strcasecmp(name, "upstreams.dnsrelay") == 0) {
+        upstream_stats_t stats[MAX_DNS_SERVERS];
+        int n = forwarder_get_stats(server->forwarder, stats, MAX_DNS_SERVERS);
+        response->answers = (dns_rr_t*)malloc(sizeof(dns_rr_t) * n);
+        for (int i = 0; i < n; ++i) {
+            char text[SOCKADDR_STRLEN + 512];
+            snprintf(text, sizeof(text), "%.*s %s srtt=%.1fms rttvar=%.1fms p95=%.1fms fail=%.1f%% "
+                     "sent=%llu ok=%llu timeout=%llu hedged=%llu hedge_wins=%llu",
+                     (int)sizeof(stats[i].name) - 1, stats[i].name, stats[i].healthy ? "up" : "down",
+                     stats[i].srtt_us / 1000.0, stats[i].rttvar_us / 1000.0, stats[i].p95_us / 1000.0,
+                     stats[i].fail_score / 10.0,
+                     (unsigned long long)stats[i].queries, (unsigned long long)stats[i].answers,
+                     (unsigned long long)stats[i].timeouts, (unsigned long long)stats[i].hedged,
+                     (unsigned long long)stats[i].hedge_wins);
+            set_txt_record(&response->answers[i], name, text);
+            hlogi("Upstream %s", text);
+        }
+        response->hdr.nanswer = n;
+    } else {
+        response->hdr.rcode = 5; // REFUSED
+        return;
+    }
+    // 超出 UDP 报文大小时减少记录并设置截断标志
+    char buf[512];
+    while (response->hdr.nanswer > 0 && dns_pack(response, buf, sizeof(buf)) < 0) {
+        --response->hdr.nanswer;
+        response->hdr.tc = 1;
+    }
+}
+
+/**
+ * @brief 回答 CHAOS 类的服务器信息查询，只在这种很少出现的查询中打包 dns_t
+ *
+ * @param server DNS服务器实例
+ * @param io 服务端 I/O 对象
+ * @param client_addr 客户端地址
+ * @param query 客户端查询报文的视图
+ * @param name 问题中的域名
+ * @param question 问题的视图
+ */
+static void answer_server_info(dns_server_t* server, hio_t* io, sockaddr_u* client_addr, const dns_view_t* query,
+                               const char* name, const dns_rr_view_t* question) {
+    dns_rr_t rr;
+    memset(&rr, 0, sizeof(rr));
+    snprintf(rr.name, sizeof(rr.name), "%s", name);
+    rr.rtype = question->rtype;
+    rr.rclass = question->rclass;
+
     dns_t response;
     memset(&response, 0, sizeof(response));
     response.hdr.transaction_id = query->hdr.transaction_id;
     response.hdr.qr = DNS_RESPONSE;
     response.hdr.rd = query->hdr.rd;
     response.hdr.ra = 1;
-    response.hdr.nquestion = query->hdr.nquestion;
+    response.hdr.nquestion = 1;
+    response.questions = &rr;
+    fill_server_info(server, name, &response);
+    send_dns_response(io, client_addr, &response);
+    // 问题在栈上，只释放应答记录
+    response.questions = NULL;
+    dns_free(&response);
+}
 
-    response.questions = (dns_rr_t*)malloc(sizeof(dns_rr_t) * query->hdr.nquestion);
-    memcpy(response.questions, query->questions, sizeof(dns_rr_t) * query->hdr.nquestion);
+/**
+ * @brief 生成缓存键，格式为 域名#类型#类#属性，属性为请求属性中的 CACHE_FLAGS 部分
+ *
+ * 带 DO 位的应答含有 RRSIG 等记录，与不带 DO 位的应答分别缓存；CD 位同理。
+ */
+static void make_cache_key(char* key, const char* name, int rtype, int rclass, int flags) {
+    snprintf(key, CACHE_KEY_MAXLEN, "%s#%d#%d#%d", name, rtype, rclass, flags & CACHE_FLAGS);
+}
 
-    dns_server_t* server = (dns_server_t*)hio_context(io);
-    bool blacklisted = is_blacklisted(server->blacklist, query->questions->name);
-
-    if (!blacklisted && check_cache(server, query, &response)) {
-        char buf[512];
-        int len = dns_pack(&response, buf, sizeof(buf));
-        if (len < 0) {
-            hloge("Failed to pack DNS response");
-            dns_free(&response);
-            return;
+/**
+ * @brief 由报文中的问题生成缓存键，格式与 make_cache_key 相同
+ *
+ * 域名用 dns_name_unpack 解码，与 on_dns_query 中的转义规则一致，只在问题部分内查找。
+ *
+ * @param buf 查询报文
+ * @param qlen 问题部分长度
+ * @param key 输出的缓存键
+ * @return 键中域名部分的长度，失败时返回-1
+ */
+static int make_raw_cache_key(const char* buf, int qlen, char* key) {
+    if (qlen < 5) return -1;
+    return dns_name_unpack(buf, (int)sizeof(dnshdr_t) + qlen - 4, sizeof(dnshdr_t), key, DNS_NAME_MAXLEN);
+}
+
+/**
+ * @brief 查询缓存，命中时直接由客户端报文构造应答
+ *
+ * 本地区域中的域名先由本地区域应答，不受黑名单影响；被黑名单匹配的域名按 config->block_mode 由模板应答。
+ * 应答由客户端的报头、问题和缓存中预先打包好的记录部分拼接而成，只改写标志、记录数和 TTL。
+ * 整个过程不解包、不编码域名，也不分配堆内存。
+ *
+ * 过期的条目视为未命中；但在上游无法及时应答时 (stale 为 true)，过期不超过 config->stale_ttl
+ * 的条目仍可使用，TTL 改写为 STALE_TTL (RFC 8767)。此时查询在收到时已查过黑名单，不再重复查询。
+ *
+ * @param server DNS服务器实例
+ * @param query 客户端的原始查询报文
+ * @param len 报文长度
+ * @param flags 请求属性，为-1时由报文取出
+ * @param buf 输出的缓冲区，至少512字节
+ * @param stale 是否允许使用过期的条目
+ * @param screened 不为 NULL 时，查过黑名单且未匹配则置为 true，调用者不必再查
+ * @return 命中时返回应答长度，未命中时返回0
+ */
+static int check_cache(dns_server_t* server, const char* query, int len, int flags, char* buf, bool stale,
+                       bool* screened) {
+    const dnshdr_t* qhdr = (const dnshdr_t*)query;
+    if (len < (int)sizeof(dnshdr_t) || qhdr->qr != DNS_QUERY || qhdr->opcode != 0 || ntohs(qhdr->nquestion) != 1) {
+        return 0;
+    }
+    int qlen = dns_question_len(query, len);
+    char key[CACHE_KEY_MAXLEN];
+    int namelen = qlen < 0 ? -1 : make_raw_cache_key(query, qlen, key);
+    if (namelen < 0) {
+        return 0;
+    }
+    uint16_t rtype, rclass;
+    memcpy(&rtype, query + sizeof(dnshdr_t) + qlen - 4, 2);
+    memcpy(&rclass, query + sizeof(dnshdr_t) + qlen - 2, 2);
+
+    // 本地区域优先于黑名单和缓存
+    int local_len = local_zone_answer(server->rules->local, query, qlen, key, ntohs(rtype), ntohs(rclass), buf);
+    if (local_len > 0) {
+        ++server->stats.local_hits;
+        hlogi("Local: %s", key);
+        return local_len;
+    }
+    if (!stale) {
+        if (is_blacklisted(server, key)) {
+            hlogi("Blacklisted: %s", key);
+            return block_response_build(&server->block, query, qlen, ntohs(rtype), ntohs(rclass), buf);
+        }
+        if (screened != NULL) *screened = true;
+    }
+    if (flags < 0) {
+        flags = raw_query_flags(query, len, qlen);
+        if (flags < 0) {
+            return 0;
         }
-        // 缓存命中
-        hlogi("Cache hit: %s", query->questions->name);
-        hio_write(io, buf, len);
-        dns_free(&response);
-        return;
     }
+    snprintf(key + namelen, CACHE_KEY_MAXLEN - namelen, "#%d#%d#%d", ntohs(rtype), ntohs(rclass), flags & CACHE_FLAGS);
 
-    if (!blacklisted && perform_dns_lookup(server, query, &response) == 0) {
-        char buf[512];
-        int len = dns_pack(&response, buf, sizeof(buf));
-        if (len < 0) {
-            hloge("Failed to pack DNS response");
-            dns_free(&response);
-            return;
+    int vlen = 0;
+    uint64_t expire = 0;
+    cached_answer_t* answer = (cached_answer_t*)cache_get(server->cache, key, &vlen, &expire);
+    if (answer == NULL || vlen < (int)sizeof(cached_answer_t)) {
+        return 0;
+    }
+    uint64_t now = hloop_now_ms(server->loop);
+    bool expired = expire != 0 && now >= expire;
+    if (expired && (!stale || now >= expire + (uint64_t)server->config->stale_ttl * 1000)) {
+        return 0;
+    }
+    int off = sizeof(dnshdr_t) + qlen;
+    int datalen = vlen - (int)sizeof(cached_answer_t);
+    if (off + datalen > 512) {
+        return 0;
+    }
+
+    memcpy(buf, query, off);
+    memcpy(buf + off, answer->data, datalen);
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    hdr->qr = DNS_RESPONSE;
+    hdr->aa = 0;
+    hdr->tc = 0;
+    hdr->ra = 1;
+    hdr->res = 0;
+    hdr->ad = 0;
+    hdr->rcode = answer->rcode;
+    hdr->nanswer = htons(answer->nanswer);
+    hdr->nauthority = htons(answer->nauthority);
+    hdr->naddtional = 0;
+    if (expire != 0) {
+        uint32_t ttl = htonl(expired ? STALE_TTL : (uint32_t)((expire - now + 999) / 1000));
+        for (int i = 0; i < answer->nttl; ++i) {
+            memcpy(buf + off + answer->ttl_offs[i], &ttl, 4);
         }
-        hlogd("Cache miss: %s", query->questions->name);
-        hio_write(io, buf, len);
+    }
+    if (expired) {
+        ++server->stats.stale_hits;
+        hlogi("Serve stale: %.*s", namelen, key);
+        return off + datalen;
+    }
+    if (answer->rcode != 0 || answer->nanswer == 0) {
+        ++server->stats.negative_hits;
+    }
+    ++server->stats.cache_hits;
+    hlogi("Cache hit: %.*s", namelen, key);
 
-    } else {
-        if(blacklisted) hlogi("Blacklisted: %s", query->questions->name);
-        else    hloge("Not found: %s", query->questions->name);
-        response.hdr.rcode = 3;
-        char buf[512];
-        int len = dns_pack(&response, buf, sizeof(buf));
-        if (len < 0) {
-            hloge("Failed to pack DNS response");
-            dns_free(&response);
-            return;
+    ++answer->hits;
+    if (answer->prefetched != 0 && now >= answer->prefetched) {
+        // 没有预取时这次查询会未命中
+        ++server->stats.prefetch_saved;
+        answer->prefetched = 0;
+    }
+    // 热门条目剩余 TTL 低于 config->prefetch 百分比时预取
+    if (expire != 0 && server->config->prefetch > 0 && answer->hits >= (uint32_t)server->config->prefetch_hits &&
+        (expire - now) * 100 <= (uint64_t)answer->ttl * 1000 * server->config->prefetch) {
+        key[namelen] = '\0';
+        prefetch(server, query, qlen, key, (uint8_t)flags, expire);
+    }
+    return off + datalen;
+}
+
+/**
+ * @brief 取出影响上游应答内容的请求属性：是否带 OPT 记录、DO 位和 CD 位
+ */
+static uint8_t query_flags(const dns_view_t* query) {
+    uint8_t flags = query->hdr.cd ? FLIGHT_CD : 0;
+    int off = query->sections[DNS_SECTION_ADDITIONAL];
+    for (int i = 0; i < query->hdr.naddtional; ++i) {
+        dns_rr_view_t rr;
+        off = dns_view_rr(query, off, 0, &rr);
+        if (rr.rtype == DNS_TYPE_OPT) {
+            // OPT 记录的 TTL 字段为扩展响应码、版本和标志，DO 是标志的最高位
+            flags |= FLIGHT_EDNS;
+            if (rr.ttl & 0x8000) flags |= FLIGHT_DO;
+            break;
+        }
+    }
+    return flags;
+}
+
+/**
+ * @brief 由原始查询报文取出请求属性，结果与 query_flags 相同
+ *
+ * 常见的查询在问题之后只有一条 OPT 记录，直接读取；其他布局才建立视图。
+ *
+ * @param query 客户端的原始查询报文
+ * @param len 报文长度
+ * @param qlen 问题部分长度
+ * @return 请求属性，报文不合法时返回-1
+ */
+static int raw_query_flags(const char* query, int len, int qlen) {
+    const dnshdr_t* hdr = (const dnshdr_t*)query;
+    int off = sizeof(dnshdr_t) + qlen;
+    int flags = hdr->cd ? FLIGHT_CD : 0;
+    if (hdr->nanswer == 0 && hdr->nauthority == 0) {
+        if (hdr->naddtional == 0) {
+            return flags;
+        }
+        // 根域名 (1字节)、类型、类、TTL、数据长度
+        if (ntohs(hdr->naddtional) == 1 && off + 11 <= len && query[off] == 0) {
+            uint16_t rtype;
+            uint32_t ttl;
+            memcpy(&rtype, query + off + 1, 2);
+            memcpy(&ttl, query + off + 5, 4);
+            if (ntohs(rtype) == DNS_TYPE_OPT) {
+                return flags | FLIGHT_EDNS | ((ntohl(ttl) & 0x8000) ? FLIGHT_DO : 0);
+            }
+        }
+    }
+    dns_view_t view;
+    if (dns_view_parse(query, len, &view) < 0) {
+        return -1;
+    }
+    return query_flags(&view);
+}
+
+/**
+ * @brief 计算在途查询的哈希值，域名不区分大小写
+ */
+static uint32_t flight_hash(const char* name, uint16_t rtype, uint16_t rclass, uint8_t flags) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const char* p = name; *p; ++p) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*p)) * 16777619u;
+    }
+    hash = (hash ^ rtype) * 16777619u;
+    hash = (hash ^ rclass) * 16777619u;
+    hash = (hash ^ flags) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief 查找问题和请求属性都相同的在途查询
+ */
+static dns_flight_t* find_flight(dns_server_t* server, uint32_t hash, const char* name, uint16_t rtype, uint16_t rclass,
+                                 uint8_t flags) {
+    dns_flight_t* flight = server->flights[hash % DNS_FLIGHT_BUCKETS];
+    for (; flight != NULL; flight = flight->next) {
+        if (flight->hash == hash && flight->rtype == rtype && flight->rclass == rclass && flight->flags == flags &&
+            strcasecmp(flight->name, name) == 0) {
+            return flight;
+        }
+    }
+    return NULL;
+}
+
+static void remove_flight(dns_server_t* server, dns_flight_t* flight) {
+    dns_flight_t** pp = &server->flights[flight->hash % DNS_FLIGHT_BUCKETS];
+    while (*pp != flight) {
+        pp = &(*pp)->next;
+    }
+    *pp = flight->next;
+}
+
+/**
+ * @brief 在热门条目过期前向上游发送一次后台刷新
+ *
+ * 刷新作为没有等待者的在途查询发出，完成后照常写入缓存。每秒最多发出 config->prefetch_rate 次。
+ *
+ * @param server DNS服务器实例
+ * @param query 命中该条目的客户端查询报文
+ * @param qlen 问题部分长度
+ * @param name 域名
+ * @param flags 客户端的请求属性，只保留其中的 CACHE_FLAGS，刷新的是同一个缓存条目
+ * @param expire 条目当前的过期时间
+ */
+static void prefetch(dns_server_t* server, const char* query, int qlen, const char* name, uint8_t flags,
+                     uint64_t expire) {
+    uint16_t rtype, rclass;
+    memcpy(&rtype, query + sizeof(dnshdr_t) + qlen - 4, 2);
+    memcpy(&rclass, query + sizeof(dnshdr_t) + qlen - 2, 2);
+    rtype = ntohs(rtype);
+    rclass = ntohs(rclass);
+    size_t namelen = strlen(name);
+    if (namelen >= DNS_NAME_MAXLEN) {
+        return;
+    }
+    // 刷新不带客户端的 OPT 记录，要求 DNSSEC 记录时换成只有 DO 位的 OPT 记录
+    flags &= CACHE_FLAGS;
+    if (flags & FLIGHT_DO) flags |= FLIGHT_EDNS;
+    uint32_t hash = flight_hash(name, rtype, rclass, flags);
+    if (find_flight(server, hash, name, rtype, rclass, flags) != NULL) {
+        return;
+    }
+    uint64_t now = hloop_now_ms(server->loop);
+    if (now - server->prefetch_window >= 1000) {
+        server->prefetch_window = now;
+        server->prefetch_count = 0;
+    }
+    if (server->prefetch_count >= server->config->prefetch_rate) {
+        return;
+    }
+
+    // 只保留报头和问题，去掉客户端的附加记录
+    char buf[sizeof(dnshdr_t) + DNS_NAME_MAXLEN + 4 + 11];
+    int len = sizeof(dnshdr_t) + qlen;
+    memcpy(buf, query, len);
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    hdr->rd = 1;
+    hdr->nanswer = hdr->nauthority = hdr->naddtional = 0;
+    if (flags & FLIGHT_DO) {
+        // 根域名，类型 OPT，类为 UDP 载荷大小 1232，TTL 中只有 DO 位，没有选项
+        static const uint8_t opt[11] = {0, 0, DNS_TYPE_OPT, 0x04, 0xD0, 0, 0, 0x80, 0, 0, 0};
+        memcpy(buf + len, opt, sizeof(opt));
+        len += sizeof(opt);
+        hdr->naddtional = htons(1);
+    }
+
+    dns_flight_t* flight;
+    SAFE_ALLOC(flight, sizeof(dns_flight_t));
+    flight->server = server;
+    flight->hash = hash;
+    memcpy(flight->name, name, namelen + 1);
+    flight->rtype = rtype;
+    flight->rclass = rclass;
+    flight->flags = flags;
+    flight->prefetch_expire = expire;
+    if (forwarder_query(server->forwarder, buf, len, on_lookup_done, flight) != 0) {
+        free(flight);
+        return;
+    }
+    flight->next = server->flights[hash % DNS_FLIGHT_BUCKETS];
+    server->flights[hash % DNS_FLIGHT_BUCKETS] = flight;
+    ++server->prefetch_count;
+    ++server->stats.prefetches;
+    hlogi("Prefetch: %s", name);
+}
+
+/**
+ * @brief 用缓存中的过期应答回复一个等待的客户端
+ *
+ * @param server DNS服务器实例
+ * @param req 客户端请求
+ * @param flags 请求所在在途查询的请求属性，req 中只保存了报头和问题
+ * @return 有可用的过期应答并已发送时返回 true
+ */
+static bool reply_stale(dns_server_t* server, dns_request_t* req, uint8_t flags) {
+    if (server->config->stale_ttl <= 0) {
+        return false;
+    }
+    char packet[512];
+    int len = check_cache(server, req->query, sizeof(dnshdr_t) + req->qlen, flags, packet, true, NULL);
+    if (len <= 0) {
+        return false;
+    }
+    send_raw_response(req->io, &req->client_addr, packet, len);
+    return true;
+}
+
+/**
+ * @brief 客户端截止时间到达时上游仍未应答，用过期应答回复等待的客户端
+ *
+ * 上游查询继续进行，收到应答后照常更新缓存。
+ */
+static void on_stale_timeout(htimer_t* timer) {
+    dns_flight_t* flight = (dns_flight_t*)hevent_userdata(timer);
+    flight->stale_timer = NULL;
+    dns_request_t** pp = &flight->waiters;
+    while (*pp != NULL) {
+        dns_request_t* req = *pp;
+        if (reply_stale(flight->server, req, flight->flags)) {
+            *pp = req->next;
+            free(req);
+            flight->stale_served = true;
+        } else {
+            pp = &req->next;
         }
-        hio_write(io, buf, len);
     }
-    dns_free(&response);
 }
 
-static int check_cache(dns_server_t* server, dns_t* query, dns_t* response) {
-    // 判断是否是 A 查询
-    if (query->questions->rtype != DNS_TYPE_A) {
+/**
+ * @brief 将未命中缓存的查询异步转发给上游
+ *
+ * 客户端的原始报文直接交给转发引擎，只改写事务ID，不重新打包。
+ * 问题相同 (qname, qtype, qclass) 的查询只向上游发送一次，后来者作为等待者挂在在途查询上。
+ *
+ * @param server DNS服务器实例
+ * @param io 服务端 I/O 对象
+ * @param query 客户端查询报文的视图
+ * @param name 问题中的域名
+ * @param question 问题的视图
+ * @param client_addr 客户端地址
+ * @return 成功提交时返回0
+ */
+static int perform_dns_lookup(dns_server_t* server, hio_t* io, const dns_view_t* query, const char* name,
+                              const dns_rr_view_t* question, sockaddr_u* client_addr) {
+    int qlen = dns_question_len(query->buf, query->len);
+    if (query->hdr.nquestion != 1 || qlen < 0) {
+        return -1;
+    }
+
+    dns_request_t* req;
+    SAFE_ALLOC(req, sizeof(dns_request_t));
+    req->io = io;
+    memcpy(&req->client_addr, client_addr, sizeof(sockaddr_u));
+    memcpy(req->query, query->buf, sizeof(dnshdr_t) + qlen);
+    req->qlen = qlen;
+
+    uint8_t flags = query_flags(query);
+    uint32_t hash = flight_hash(name, question->rtype, question->rclass, flags);
+    dns_flight_t* flight = find_flight(server, hash, name, question->rtype, question->rclass, flags);
+    if (flight != NULL) {
+        ++server->stats.coalesced;
+        hlogd("Coalesced: %s", name);
+        // 上游已经超过客户端截止时间，不再等待
+        if (flight->stale_served && reply_stale(server, req, flags)) {
+            free(req);
+            return 0;
+        }
+        req->next = flight->waiters;
+        flight->waiters = req;
         return 0;
     }
-    const char* cached_value = cache_get(server->cache, query->questions->name);
-    if (cached_value != NULL) {
-        build_dns_response(response, query, 1, cached_value, query->questions->rtype);
-        return 1;
+
+    SAFE_ALLOC(flight, sizeof(dns_flight_t));
+    flight->server = server;
+    flight->hash = hash;
+    snprintf(flight->name, sizeof(flight->name), "%s", name);
+    flight->rtype = question->rtype;
+    flight->rclass = question->rclass;
+    flight->flags = flags;
+    flight->waiters = req;
+    if (forwarder_query(server->forwarder, query->buf, query->len, on_lookup_done, flight) != 0) {
+        free(flight);
+        free(req);
+        return -1;
+    }
+    if (server->config->stale_ttl > 0) {
+        flight->stale_timer = htimer_add(server->loop, on_stale_timeout, server->config->stale_timeout, 1);
+        hevent_set_userdata(flight->stale_timer, flight);
     }
+    flight->next = server->flights[hash % DNS_FLIGHT_BUCKETS];
+    server->flights[hash % DNS_FLIGHT_BUCKETS] = flight;
+    ++server->stats.forwarded;
     return 0;
 }
 
-static void build_dns_response(dns_t* response, dns_t* query, int addr_cnt, const char* cached_value, int type) {
-    response->hdr.nanswer = addr_cnt;
-    response->answers = (dns_rr_t*)malloc(sizeof(dns_rr_t) * addr_cnt);
-    for (int i = 0; i < addr_cnt; ++i) {
-        dns_rr_t* rr = &response->answers[i];
-        memcpy(rr, query->questions, sizeof(dns_rr_t));
-        rr->rclass = DNS_CLASS_IN;
-        rr->ttl = 3600;
-        if (type == DNS_TYPE_A) {
-            rr->rtype = DNS_TYPE_A;
-            rr->datalen = 4;
-            rr->data = (char*)malloc(4);
-            memcpy(rr->data, cached_value + i * 4, 4); // 处理多个IPv4地址
-        } else if (type == DNS_TYPE_AAAA) {
-            rr->rtype = DNS_TYPE_AAAA;
-            rr->datalen = 16;
-            rr->data = (char*)malloc(16);
-            memcpy(rr->data, cached_value + i * 16, 16); // 处理多个IPv6地址
-        }
+/**
+ * @brief 跳过报文中的一个域名
+ *
+ * @param buf 报文
+ * @param len 报文长度
+ * @param off 域名的起始偏移
+ * @return 域名之后的偏移，报文不完整时返回-1
+ */
+static int skip_name(const char* buf, int len, int off) {
+    while (off < len) {
+        uint8_t label = (uint8_t)buf[off];
+        if (label == 0) return off + 1;
+        if (label >= 192) return off + 2 <= len ? off + 2 : -1;
+        if (label > 63) return -1;
+        off += 1 + label;
     }
+    return -1;
 }
 
-static int perform_dns_lookup(dns_server_t* server, dns_t* query, dns_t* response) {
-    int addr_cnt = 0;
-    uint32_t addrs[10];
-    uint8_t addrs6[10][16];
-    int naddr = sizeof(addrs) / sizeof(addrs[0]);
-    int naddr6 = sizeof(addrs6) / sizeof(addrs6[0]);
+/**
+ * @brief 将上游应答写入缓存
+ *
+ * 肯定应答缓存完整的应答部分 (包括 CNAME 链和多个地址)，TTL 取其中所有记录的最小值；
+ * NXDOMAIN 和 NODATA 的否定应答连同权威部分一起缓存，按 RFC 2308 TTL 取 SOA 记录的
+ * TTL 与其 MINIMUM 字段中较小者，没有 SOA 记录时不缓存。TTL 按配置的上下限截断。
+ *
+ * 记录部分按原始报文保存，不解包。
+ *
+ * @param server DNS服务器实例
+ * @param flight 完成的在途查询
+ * @param buf 上游应答报文
+ * @param len 报文长度
+ */
+static void cache_answer(dns_server_t* server, dns_flight_t* flight, char* buf, int len) {
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    if (hdr->tc || (hdr->rcode != 0 && hdr->rcode != 3)) {
+        return;
+    }
+    int nanswer = ntohs(hdr->nanswer);
+    int nauthority = ntohs(hdr->nauthority);
+    bool negative = hdr->rcode == 3 || nanswer == 0;
+    int nrr = negative ? nanswer + nauthority : nanswer;
+    int start = sizeof(dnshdr_t) + dns_question_len(buf, len);
+    if (nrr > MAX_CACHED_RRS || len - start < 0) {
+        return;
+    }
 
-    if (query->questions->rtype == DNS_TYPE_A) {
-        addr_cnt = nslookup(query->questions->name, addrs, naddr, server->config->dns_server_ipaddr);
-        if (addr_cnt > 0) {
-            build_dns_response(response, query, addr_cnt, (const char*)addrs, DNS_TYPE_A);
-            // 如果有多个，只缓存第一个IPv4地址
-            cache_insert(server->cache, query->questions->name, (const char*)&addrs[0]);
-            hlogi("Cache insert: %s", query->questions->name);
+    char value[sizeof(cached_answer_t) + CACHE_DATA_MAXLEN];
+    cached_answer_t* answer = (cached_answer_t*)value;
+    memset(answer, 0, sizeof(cached_answer_t));
+    answer->rcode = hdr->rcode;
+    answer->nanswer = nanswer;
+    answer->nauthority = negative ? nauthority : 0;
+    int64_t ttl = -1;
+    bool has_soa = false;
+    int off = start;
+    for (int i = 0; i < nrr; ++i) {
+        off = skip_name(buf, len, off);
+        if (off < 0 || off + 10 > len) {
+            return;
         }
-    } else if (query->questions->rtype == DNS_TYPE_AAAA) {
-        addr_cnt = nslookup6(query->questions->name, addrs6, naddr6, server->config->dns_server_ipaddr);
-        if (addr_cnt > 0) {
-            build_dns_response(response, query, addr_cnt, (const char*)addrs6, DNS_TYPE_AAAA);
+        uint16_t rtype, rdlen;
+        uint32_t rttl;
+        memcpy(&rtype, buf + off, 2);
+        memcpy(&rttl, buf + off + 4, 4);
+        memcpy(&rdlen, buf + off + 8, 2);
+        rtype = ntohs(rtype);
+        rttl = ntohl(rttl);
+        rdlen = ntohs(rdlen);
+        if (off + 10 + rdlen > len) {
+            return;
+        }
+        answer->ttl_offs[answer->nttl++] = off + 4 - start;
+        if (i >= nanswer) {
+            // 权威部分只有 SOA 记录决定否定应答的 TTL
+            if (rtype != DNS_TYPE_SOA || rdlen < 20) {
+                off += 10 + rdlen;
+                continue;
+            }
+            // MINIMUM 是 SOA 记录数据的最后4个字节
+            uint32_t minimum;
+            memcpy(&minimum, buf + off + 10 + rdlen - 4, 4);
+            rttl = MIN(rttl, ntohl(minimum));
+            has_soa = true;
         }
+        if (ttl < 0 || rttl < ttl) ttl = rttl;
+        off += 10 + rdlen;
+    }
+    int datalen = off - start;
+    // 保证拼接任意客户端问题后仍不超过512字节
+    if (ttl < 0 || (negative && !has_soa) || start + datalen > 512) {
+        return;
     }
 
-    return addr_cnt > 0 ? 0 : -1;
+    ttl = LIMIT(server->config->min_ttl, ttl, server->config->max_ttl);
+    if (ttl == 0) {
+        return;
+    }
+    answer->ttl = ttl;
+    answer->prefetched = flight->prefetch_expire;
+    memcpy(answer->data, buf + start, datalen);
+    char key[CACHE_KEY_MAXLEN];
+    make_cache_key(key, flight->name, flight->rtype, flight->rclass, flight->flags);
+    cache_insert(server->cache, key, value, sizeof(cached_answer_t) + datalen, hloop_now_ms(server->loop) + ttl * 1000);
+    hlogi("Cache insert: %s type=%d rcode=%d records=%d ttl=%d", flight->name, flight->rtype, answer->rcode, nrr, (int)ttl);
 }
 
 /**
- * @brief 加载黑名单
+ * @brief 将上游应答转发给一个等待的客户端
  *
- * @param blacklist 黑名单Trie树
- * @praam cache 缓存
- * @param filename 黑名单文件路径
- * @return 成功时返回0
+ * 只恢复客户端的事务ID、RD 标志和问题部分 (保留域名大小写)。
+ * 客户端没有携带 OPT 记录时去掉附加部分，其中的 OPT 记录不能发给不支持 EDNS 的客户端 (RFC 6891)；
+ * 去掉后仍超过512字节时，只返回报头和问题并设置截断标志。
+ *
+ * @param req 客户端请求
+ * @param edns 客户端是否携带了 OPT 记录
+ * @param buf 上游应答报文，问题部分与请求的长度相同，多个客户端依次使用
+ * @param len 报文长度
  */
-static int load_blacklist(cache_t* blacklist, cache_t* cache, const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("fopen");
-        return -1;
+static void relay_response(dns_request_t* req, bool edns, char* buf, int len) {
+    dnshdr_t* qhdr = (dnshdr_t*)req->query;
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    hdr->transaction_id = qhdr->transaction_id;
+    hdr->rd = qhdr->rd;
+    memcpy(buf + sizeof(dnshdr_t), req->query + sizeof(dnshdr_t), req->qlen);
+    if (edns) {
+        send_raw_response(req->io, &req->client_addr, buf, len);
+        return;
     }
 
-    char line[512];
-    while (fgets(line, sizeof(line), file)) {
-        // 去掉行末的换行符
-        line[strcspn(line, "\n")] = '\0';
+    char packet[512];
+    dns_view_t view;
+    int end;
+    if (dns_view_parse(buf, len, &view) < 0 || view.sections[DNS_SECTION_ADDITIONAL] > (int)sizeof(packet)) {
+        end = sizeof(dnshdr_t) + req->qlen;
+        memcpy(packet, buf, end);
+        hdr = (dnshdr_t*)packet;
+        hdr->tc = 1;
+        hdr->nanswer = hdr->nauthority = 0;
+    } else {
+        end = view.sections[DNS_SECTION_ADDITIONAL];
+        memcpy(packet, buf, end);
+        hdr = (dnshdr_t*)packet;
+    }
+    hdr->naddtional = 0;
+    send_raw_response(req->io, &req->client_addr, packet, end);
+}
 
-        // 用空格分割 IP 和域名
-        char* ip = strtok(line, " ");
-        char* domain = strtok(NULL, " ");
+/**
+ * @brief 根据客户端请求的报头和问题构造一个错误应答并发送
+ *
+ * @param req 客户端请求
+ * @param rcode 响应码
+ */
+static void reply_error(dns_request_t* req, int rcode) {
+    char buf[sizeof(req->query)];
+    int len = sizeof(dnshdr_t) + req->qlen;
+    memcpy(buf, req->query, len);
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    hdr->qr = DNS_RESPONSE;
+    hdr->aa = 0;
+    hdr->tc = 0;
+    hdr->ra = 1;
+    hdr->ad = 0;
+    hdr->rcode = rcode;
+    hdr->nquestion = htons(1);
+    hdr->nanswer = hdr->nauthority = hdr->naddtional = 0;
+    send_raw_response(req->io, &req->client_addr, buf, len);
+}
 
-        if (ip != NULL && domain != NULL) {
-            if (strcmp(ip, "0.0.0.0") == 0) {
-                cache_insert(blacklist, domain, "");
-            } else {
-                uint32_t addr;
-                inet_pton(AF_INET, ip, &addr); // 将IP地址转换成uint32_t
-                cache_insert(cache, domain, (const char*)&addr);
-            }
+/**
+ * @brief 上游查询完成回调，将应答转发给所有等待的客户端
+ *
+ * 应答只在写入缓存时按原始报文遍历一次记录，不解包。
+ * 上游超时或返回 SERVFAIL/REFUSED 时，有过期应答的客户端收到过期应答，其余客户端收到 SERVFAIL。
+ *
+ * @param userdata 在途查询
+ * @param status 查询状态
+ * @param buf 上游应答报文
+ * @param len 报文长度
+ */
+static void on_lookup_done(void* userdata, int status, char* buf, int len) {
+    dns_flight_t* flight = (dns_flight_t*)userdata;
+    dns_server_t* server = flight->server;
+    remove_flight(server, flight);
+    if (flight->stale_timer != NULL) {
+        htimer_del(flight->stale_timer);
+    }
+
+    bool failed = status != 0;
+    if (status == 0) {
+        hlogd("Cache miss: %s", flight->name);
+        int rcode = ((dnshdr_t*)buf)->rcode;
+        failed = rcode == 2 || rcode == 5; // SERVFAIL, REFUSED
+        cache_answer(server, flight, buf, len);
+    } else if (status != ECANCELED) {
+        hloge("Upstream failed: %s", flight->name);
+    }
+
+    dns_request_t* req = flight->waiters;
+    while (req != NULL) {
+        dns_request_t* next = req->next;
+        if (status == ECANCELED || (failed && reply_stale(server, req, flight->flags))) {
+            // 已取消或已用过期应答回复
+        } else if (status == 0) {
+            relay_response(req, (flight->flags & FLIGHT_EDNS) != 0, buf, len);
+        } else {
+            reply_error(req, 2); // SERVFAIL
         }
+        free(req);
+        req = next;
     }
+    free(flight);
+}
 
-    fclose(file);
-    return 0;
+/**
+ * @brief 加载规则文件
+ *
+ * 0.0.0.0 的域名构建为只读的黑名单，没有数量限制；A、AAAA 和 CNAME 记录构建为本地区域，预先打包成应答。
+ * 黑名单的域名可写作 *.example.com (只匹配子域名)，也可单独一行写作 ||example.com^ (匹配域名及其子域名)。
+ * 以 # 或 ! 开头的行为注释。文件由 hosts_load 在多个线程中并行解析。
+ * 文件也可以是 dns_relay_compile 编译的规则镜像，此时直接映射，不需要解析。
+ *
+ * 不访问服务器的任何状态，可以在后台线程中调用。
+ *
+ * @param filename 规则文件路径
+ * @return 成功时返回规则，失败时返回 NULL
+ */
+static dns_rules_t* load_rules(const char* filename) {
+    unsigned long long start_us = gethrtime_us();
+    hosts_t hosts;
+    rules_image_t* image = NULL;
+    if (rules_image_probe(filename)) {
+        image = rules_image_open(filename, &hosts);
+        if (image == NULL) {
+            return NULL;
+        }
+    } else if (hosts_load(filename, &hosts) != 0) {
+        hloge("Failed to open %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    dns_rules_t* rules = (dns_rules_t*)calloc(1, sizeof(dns_rules_t));
+    rules->image = image;
+    rules->blacklist = hosts.blacklist;
+    hosts.blacklist = NULL;
+    rules->local = local_zone_create(hosts.records, hosts.nrecords, LOCAL_TTL);
+
+    unsigned long long elapsed_us = MAX(gethrtime_us() - start_us, 1ULL);
+    hlogi("Loaded %zu blacklist rules (%zu KiB) and %d local records for %d names from %s",
+          blocklist_size(rules->blacklist), blocklist_memory(rules->blacklist) >> 10, hosts.nrecords,
+          local_zone_size(rules->local), filename);
+    if (image != NULL) {
+        hlogi("Mapped rules image (%zu KiB) in %llu ms", hosts.bytes >> 10, elapsed_us / 1000);
+    } else {
+        hlogi("Parsed %zu lines (%zu KiB) in %llu ms with %d threads, %.0f lines/s", hosts.lines, hosts.bytes >> 10,
+              elapsed_us / 1000, hosts.threads, hosts.lines * 1e6 / elapsed_us);
+    }
+    hosts_free(&hosts);
+    return rules;
+}
+
+static void free_rules(dns_rules_t* rules) {
+    if (rules == NULL) return;
+    blocklist_destroy(rules->blacklist);
+    local_zone_destroy(rules->local);
+    rules_image_close(rules->image);
+    free(rules);
+}
+
+static bool is_blacklisted(dns_server_t* server, const char* domain) {
+    switch (blocklist_lookup(server->rules->blacklist, domain)) {
+        case BLOCKLIST_FILTERED:
+            ++server->stats.filter_rejects;
+            return false;
+        case BLOCKLIST_UNMATCHED:
+            ++server->stats.filter_false_positives;
+            return false;
+        default:
+            ++server->stats.blacklisted;
+            return true;
+    }
+}
+/* ---------------- 规则文件的重新加载 ---------------- */
+
+static HTHREAD_ROUTINE(reload_thread);
+static void on_reload_done(hevent_t* ev);
+
+int dns_server_reload(dns_server_t* server) {
+#ifdef OS_UNIX
+    // 只调用 write，可在信号处理函数中使用
+    return write(server->reload_pipe[1], "r", 1) == 1 ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+int dns_server_shutdown(dns_server_t* server) {
+#ifdef OS_UNIX
+    if (write(server->reload_pipe[1], "q", 1) == 1) {
+        return 0;
+    }
+#endif
+    return hloop_stop(server->loop);
 }
 
-static bool is_blacklisted(cache_t* blacklist, const char* domain) {
-    return cache_get(blacklist, domain) != NULL;
-}
\ No newline at end of file
+/**
+ * @brief 在后台线程中加载规则文件，已有加载在进行时等它完成后再加载一次
+ */
+static void start_reload(dns_server_t* server) {
+    if (server->reload != NULL) {
+        server->reload_pending = true;
+        return;
+    }
+    dns_reload_t* reload = (dns_reload_t*)calloc(1, sizeof(dns_reload_t));
+    reload->server = server;
+    reload->start_us = hloop_now_us(server->loop);
+    server->reload = reload;
+    hlogi("Reloading %s", server->config->filename);
+    reload->thread = hthread_create(reload_thread, reload);
+}
+
+static HTHREAD_ROUTINE(reload_thread) {
+    dns_reload_t* reload = (dns_reload_t*)userdata;
+    dns_server_t* server = reload->server;
+    reload->rules = load_rules(server->config->filename);
+    // 回到事件循环线程中替换
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.cb = on_reload_done;
+    ev.userdata = server;
+    hloop_post_event(server->loop, &ev);
+    return (HTHREAD_RETTYPE)0;
+}
+
+/**
+ * @brief 新规则构建完成，替换旧规则
+ *
+ * 所有查询都在事件循环线程中处理，且不会跨越回调持有规则的指针，
+ * 因此在这里替换后旧规则不再有读者，可以立即释放。
+ */
+static void on_reload_done(hevent_t* ev) {
+    dns_server_t* server = (dns_server_t*)hevent_userdata(ev);
+    dns_reload_t* reload = server->reload;
+    if (reload == NULL) {
+        // 服务器已停止
+        return;
+    }
+    hthread_join(reload->thread);
+    server->reload = NULL;
+    if (reload->rules != NULL) {
+        dns_rules_t* old = server->rules;
+        server->rules = reload->rules;
+        free_rules(old);
+        hloop_update_time(server->loop);
+        hlogi("Reloaded %s in %llums", server->config->filename,
+              (unsigned long long)(hloop_now_us(server->loop) - reload->start_us) / 1000);
+    } else {
+        hloge("Failed to reload %s, keeping the previous rules", server->config->filename);
+    }
+    free(reload);
+
+    if (server->reload_pending) {
+        server->reload_pending = false;
+        start_reload(server);
+    }
+}
+
+/**
+ * @brief 停止时等待进行中的加载结束并丢弃结果
+ */
+static void cancel_reload(dns_server_t* server) {
+    dns_reload_t* reload = server->reload;
+    if (reload == NULL) {
+        return;
+    }
+    server->reload = NULL;
+    hthread_join(reload->thread);
+    free_rules(reload->rules);
+    free(reload);
+}
+
+static void on_reload_timer(htimer_t* timer) {
+    dns_server_t* server = (dns_server_t*)hevent_userdata(timer);
+    server->reload_timer = NULL;
+    start_reload(server);
+}
+
+// 延迟重新加载，合并短时间内的多次请求
+static void schedule_reload(dns_server_t* server) {
+    if (server->reload_timer == NULL) {
+        server->reload_timer = htimer_add(server->loop, on_reload_timer, RELOAD_DELAY, 1);
+        hevent_set_userdata(server->reload_timer, server);
+    }
+}
+
+#ifdef OS_UNIX
+// 唤醒管道可读，即收到了 SIGHUP 等重新加载请求，或 SIGINT 等停止请求 ("q")
+static void on_reload_request(hio_t* io, void* buf, int readbytes) {
+    dns_server_t* server = (dns_server_t*)hio_context(io);
+    if (memchr(buf, 'q', readbytes) != NULL) {
+        hloop_stop(server->loop);
+        return;
+    }
+    schedule_reload(server);
+}
+#endif
+
+#ifdef OS_LINUX
+// 规则文件所在目录的 inotify 事件，只关心规则文件本身
+static void on_rules_changed(hio_t* io, void* buf, int readbytes) {
+    dns_server_t* server = (dns_server_t*)hio_context(io);
+    const char* filename = server->config->filename;
+    const char* base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    for (int off = 0; off + (int)sizeof(struct inotify_event) <= readbytes; ) {
+        struct inotify_event event;
+        memcpy(&event, (char*)buf + off, sizeof(event));
+        const char* name = (const char*)buf + off + sizeof(event);
+        if (event.len > 0 && strcmp(name, base) == 0) {
+            hlogi("%s changed", filename);
+            schedule_reload(server);
+            return;
+        }
+        off += sizeof(event) + event.len;
+    }
+}
+#endif
+
+/**
+ * @brief 监视规则文件的变化并接收重新加载请求
+ *
+ * 编辑器和部署工具通常写入临时文件后重命名，因此监视的是文件所在的目录。
+ */
+static void watch_rules(dns_server_t* server) {
+    server->reload_pipe[0] = server->reload_pipe[1] = -1;
+#ifdef OS_UNIX
+    if (pipe(server->reload_pipe) == 0) {
+        hio_t* io = hio_get(server->loop, server->reload_pipe[0]);
+        hio_set_context(io, server);
+        hio_setcb_read(io, on_reload_request);
+        hio_read(io);
+    } else {
+        hlogw("Failed to create reload pipe: %s", strerror(errno));
+    }
+#endif
+#ifdef OS_LINUX
+    char dir[1024];
+    const char* filename = server->config->filename;
+    const char* slash = strrchr(filename, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", slash == filename ? 1 : (int)(slash - filename), filename);
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        hlogw("Failed to watch %s: %s", filename, strerror(errno));
+        if (fd >= 0) close(fd);
+        return;
+    }
+    hio_t* io = hio_get(server->loop, fd);
+    hio_set_context(io, server);
+    hio_setcb_read(io, on_rules_changed);
+    hio_read(io);
+#endif
+}
@@ -0,0 +1,784 @@
+#include "forwarder.h"
+#include "dns.h"
+#include <ctype.h>
+#include <hv/hdef.h>
+#include <hv/herr.h>
+#include <hv/hlog.h>
+
+#define FORWARDER_MAX_PENDING   65536   // 16位事务ID空间
+#define FORWARDER_POOL_SIZE     8       // 每个协议族的上游套接字池大小
+#define FORWARDER_ROTATE_MS     30000   // 每隔多久轮换池中的一个套接字
+#define FORWARDER_PORT_MIN      1024    // 随机源端口范围
+#define FORWARDER_PORT_MAX      65535
+#define FORWARDER_BIND_RETRY    16      // 随机端口被占用时的重试次数
+
+#define FORWARDER_INITIAL_RTO   1000    // 尚未测得往返时间时的单次重传超时 (ms)
+#define FORWARDER_MIN_RTO       50      // 单次重传超时下限 (ms)
+#define FORWARDER_PROBE_MS      2000    // 向非首选上游发送探测的间隔 (ms)
+#define FORWARDER_FAIL_MAX      1000    // 失败分数上限，分数为超时率的千分比
+#define FORWARDER_FAIL_DOWN     500     // 失败分数达到该值时视为不可用
+
+#define FORWARDER_RTT_SAMPLES   128     // 用于估计 p95 的最近往返时间样本数
+#define FORWARDER_P95_REFRESH   16      // 每收到多少个新样本重新计算一次 p95
+#define FORWARDER_HEDGE_BURST   20      // 对冲令牌桶容量
+
+// 协议族在套接字池中的下标
+#define FAMILY_INDEX(family) ((family) == AF_INET6 ? 1 : 0)
+
+// 一个上游服务器及其根据实际流量维护的状态
+typedef struct upstream_s {
+    char        name[SOCKADDR_STRLEN];  // ip:port
+    sockaddr_u  addr;
+    bool        measured;       // 是否已有往返时间样本
+    uint32_t    srtt_us;        // 平滑往返时间
+    uint32_t    rttvar_us;      // 往返时间偏差
+    uint32_t    fail_score;     // 失败分数，超时的指数加权移动平均
+    uint64_t    last_sample_ms; // 最近一次收到应答或超时的时间
+    uint64_t    queries;        // 发出的查询数，包括探测
+    uint64_t    answers;        // 收到的应答数
+    uint64_t    timeouts;       // 超时数
+    uint32_t    samples[FORWARDER_RTT_SAMPLES]; // 最近的往返时间样本环
+    uint64_t    nsamples;       // 累计样本数
+    uint32_t    p95_us;         // 最近样本的 95 分位往返时间
+    uint64_t    hedged;         // 作为对冲目标收到的查询数
+    uint64_t    hedge_wins;     // 对冲查询先于原查询返回的次数
+} upstream_t;
+
+// 池中的一个长期存在的上游套接字，多个在途查询复用同一个套接字
+typedef struct upstream_sock_s {
+    forwarder_t*            fwd;
+    hio_t*                  io;
+    int                     family;
+    uint16_t                port;       // 本地源端口
+    int                     npending;   // 使用该套接字的在途查询数
+    bool                    retired;    // 已被轮换出池，在途查询完成后关闭
+    struct upstream_sock_s* next;       // 待关闭链表
+} upstream_sock_t;
+
+// 一个正在等待上游应答的查询
+typedef struct forward_query_s {
+    forwarder_t*    fwd;
+    upstream_sock_t* socks[2];  // 各协议族发送查询所用的套接字
+    uint16_t        id;         // 上游事务ID
+    uint16_t        orig_id;    // 发起方的事务ID
+    char*           buf;        // 发往上游的报文副本，用于重发和校验应答
+    int             len;
+    int             qlen;       // 问题部分长度
+    uint32_t        sent;       // 已发送过的上游位图
+    uint32_t        charged;    // 已记过超时的上游位图
+    uint64_t        sent_us[MAX_DNS_SERVERS]; // 发往各上游的时间
+    int             current;    // 当前等待的上游
+    bool            failover;   // 超时后是否转移到其他上游，探测查询不转移
+    uint64_t        deadline_us; // 整个查询的截止时间
+    htimer_t*       timer;      // 单次重传超时定时器
+    htimer_t*       hedge_timer; // 对冲定时器
+    uint32_t        hedged;     // 作为对冲发送的上游位图
+    forward_cb      cb;         // 为 NULL 时表示探测查询
+    void*           userdata;
+} forward_query_t;
+
+struct forwarder_s {
+    hloop_t*            loop;
+    struct Config*      config;
+    upstream_t          upstreams[MAX_DNS_SERVERS];
+    int                 nupstream;
+    uint64_t            last_probe_ms;  // 上次探测时间
+    double              hedge_tokens;   // 对冲令牌，每个新查询按 hedge_percent 累积
+    upstream_sock_t*    pool[2][FORWARDER_POOL_SIZE]; // 按协议族划分的上游套接字池
+    upstream_sock_t*    retired;        // 已轮换出池、等待在途查询完成的套接字
+    int                 rotate_index;   // 下一个要轮换的池位置
+    htimer_t*           rotate_timer;
+    uint64_t            rng_state[2];   // 事务ID和源端口的随机数状态
+    int                 npending;
+    forward_query_t*    pending[FORWARDER_MAX_PENDING]; // 以上游事务ID为键的在途查询表
+};
+
+static void on_upstream_recv(hio_t* io, void* buf, int readbytes);
+static void on_query_timeout(htimer_t* timer);
+static void on_hedge_timeout(htimer_t* timer);
+static void on_rotate(htimer_t* timer);
+
+/**
+ * @brief 初始化随机数状态，优先使用系统熵源
+ */
+static void rng_seed(forwarder_t* fwd) {
+    uint64_t seed[2] = {0, 0};
+    FILE* fp = fopen("/dev/urandom", "rb");
+    if (fp) {
+        if (fread(seed, sizeof(seed), 1, fp) != 1) {
+            seed[0] = seed[1] = 0;
+        }
+        fclose(fp);
+    }
+    // 没有系统熵源时退化为时间、进程号和地址的混合
+    seed[0] ^= (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)(uintptr_t)fwd;
+    seed[1] ^= ((uint64_t)getpid() << 32) ^ (uint64_t)clock() ^ 0xBF58476D1CE4E5B9ULL;
+    fwd->rng_state[0] = seed[0] ? seed[0] : 1;
+    fwd->rng_state[1] = seed[1];
+}
+
+/**
+ * @brief xorshift128+ 伪随机数
+ */
+static uint64_t rng_next(forwarder_t* fwd) {
+    uint64_t s1 = fwd->rng_state[0];
+    const uint64_t s0 = fwd->rng_state[1];
+    fwd->rng_state[0] = s0;
+    s1 ^= s1 << 23;
+    fwd->rng_state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+    return fwd->rng_state[1] + s0;
+}
+
+/**
+ * @brief 比较两个问题部分，域名不区分大小写
+ */
+static bool question_equal(const char* a, const char* b, int len) {
+    for (int i = 0; i < len; ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 比较两个套接字地址的协议族、地址和端口
+ */
+static bool sockaddr_equal(sockaddr_u* a, sockaddr_u* b) {
+    if (a->sa.sa_family != b->sa.sa_family) return false;
+    if (a->sa.sa_family == AF_INET) {
+        return a->sin.sin_port == b->sin.sin_port &&
+               a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+    }
+    return a->sin6.sin6_port == b->sin6.sin6_port &&
+           memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof(a->sin6.sin6_addr)) == 0;
+}
+
+/**
+ * @brief 解析上游服务器地址，支持 ip、ip:port、[ipv6]:port 三种写法
+ *
+ * @param spec 地址字符串
+ * @param addr 输出的套接字地址
+ * @return 成功时返回0
+ */
+static int parse_upstream(const char* spec, sockaddr_u* addr) {
+    char host[SOCKADDR_STRLEN];
+    int port = DNS_PORT;
+    const char* colon = strrchr(spec, ':');
+    memset(addr, 0, sizeof(sockaddr_u));
+    if (spec[0] == '[') {
+        const char* end = strchr(spec, ']');
+        if (end == NULL || end - spec - 1 >= (int)sizeof(host)) return -1;
+        memcpy(host, spec + 1, end - spec - 1);
+        host[end - spec - 1] = '\0';
+        if (end[1] == ':') port = atoi(end + 2);
+    } else if (colon != NULL && strchr(spec, ':') == colon) {
+        // 只有一个冒号，视为 IPv4 地址加端口
+        if (colon - spec >= (int)sizeof(host)) return -1;
+        memcpy(host, spec, colon - spec);
+        host[colon - spec] = '\0';
+        port = atoi(colon + 1);
+    } else {
+        if (strlen(spec) >= sizeof(host)) return -1;
+        strcpy(host, spec);
+    }
+    if (port <= 0 || port > 65535) return -1;
+    return sockaddr_set_ipport(addr, host, port);
+}
+
+/**
+ * @brief 创建一个绑定到随机源端口的非阻塞 UDP 套接字并加入事件循环
+ *
+ * @param fwd 转发引擎
+ * @param family 协议族
+ * @return 成功时返回套接字，失败时返回 NULL
+ */
+static upstream_sock_t* sock_open(forwarder_t* fwd, int family) {
+    int sockfd = socket(family, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return NULL;
+    }
+    sockaddr_u local;
+    uint16_t port = 0;
+    int i;
+    for (i = 0; i < FORWARDER_BIND_RETRY; ++i) {
+        port = FORWARDER_PORT_MIN + rng_next(fwd) % (FORWARDER_PORT_MAX - FORWARDER_PORT_MIN + 1);
+        memset(&local, 0, sizeof(local));
+        sockaddr_set_ipport(&local, family == AF_INET6 ? "::" : "0.0.0.0", port);
+        if (bind(sockfd, &local.sa, sockaddr_len(&local)) == 0) break;
+    }
+    if (i == FORWARDER_BIND_RETRY) {
+        hlogw("Failed to bind a random source port, falling back to an ephemeral port");
+        port = 0;
+    }
+
+    upstream_sock_t* sock;
+    SAFE_ALLOC(sock, sizeof(upstream_sock_t));
+    sock->fwd = fwd;
+    sock->family = family;
+    sock->port = port;
+    sock->io = hio_get(fwd->loop, sockfd);
+    hio_set_context(sock->io, sock);
+    hio_setcb_read(sock->io, on_upstream_recv);
+    hio_read(sock->io);
+    hlogd("Upstream socket opened on port %u", port);
+    return sock;
+}
+
+static void sock_close(upstream_sock_t* sock) {
+    hlogd("Upstream socket on port %u closed", sock->port);
+    hio_close(sock->io);
+    free(sock);
+}
+
+/**
+ * @brief 将已轮换出池且没有在途查询的套接字关闭
+ */
+static void sock_reap(forwarder_t* fwd) {
+    upstream_sock_t** pp = &fwd->retired;
+    while (*pp) {
+        upstream_sock_t* sock = *pp;
+        if (sock->npending == 0) {
+            *pp = sock->next;
+            sock_close(sock);
+        } else {
+            pp = &sock->next;
+        }
+    }
+}
+
+/**
+ * @brief 分配一个未被占用的随机上游事务ID
+ */
+static uint16_t alloc_id(forwarder_t* fwd) {
+    uint16_t id = (uint16_t)rng_next(fwd);
+    // 随机探测几次，表很满时退化为从随机起点线性查找
+    for (int i = 0; i < 8 && fwd->pending[id] != NULL; ++i) {
+        id = (uint16_t)rng_next(fwd);
+    }
+    while (fwd->pending[id] != NULL) {
+        ++id;
+    }
+    return id;
+}
+
+/**
+ * @brief 计算上游的单次重传超时，即 srtt + 4 * rttvar
+ *
+ * @return 超时时间 (ms)
+ */
+static uint32_t upstream_rto(forwarder_t* fwd, upstream_t* up) {
+    uint32_t rto = FORWARDER_INITIAL_RTO;
+    if (up->measured) {
+        rto = (up->srtt_us + 4 * up->rttvar_us) / 1000;
+    }
+    return LIMIT(FORWARDER_MIN_RTO, rto, (uint32_t)fwd->config->rto);
+}
+
+static int cmp_uint32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 记录一个往返时间样本，每积累若干新样本重新计算 p95
+ */
+static void upstream_add_sample(upstream_t* up, uint32_t rtt_us) {
+    up->samples[up->nsamples % FORWARDER_RTT_SAMPLES] = rtt_us;
+    ++up->nsamples;
+    if (up->nsamples % FORWARDER_P95_REFRESH == 0) {
+        uint32_t sorted[FORWARDER_RTT_SAMPLES];
+        int n = (int)MIN(up->nsamples, FORWARDER_RTT_SAMPLES);
+        memcpy(sorted, up->samples, n * sizeof(uint32_t));
+        qsort(sorted, n, sizeof(uint32_t), cmp_uint32);
+        up->p95_us = sorted[n * 95 / 100];
+    }
+}
+
+/**
+ * @brief 计算对冲阈值，超过该时间仍未应答时向另一个上游发送副本
+ *
+ * 样本足够时使用 p95，否则用 srtt + 2 * rttvar 近似。
+ *
+ * @return 阈值 (ms)，尚无样本时返回0表示不对冲
+ */
+static uint32_t upstream_hedge_ms(upstream_t* up) {
+    uint32_t us;
+    if (up->nsamples >= FORWARDER_P95_REFRESH) {
+        us = up->p95_us;
+    } else if (up->measured) {
+        us = up->srtt_us + 2 * up->rttvar_us;
+    } else {
+        return 0;
+    }
+    return MAX(us / 1000, 1);
+}
+
+static bool upstream_healthy(upstream_t* up) {
+    return up->fail_score < FORWARDER_FAIL_DOWN;
+}
+
+/**
+ * @brief 记录一次成功应答，按 RFC 6298 的方法更新平滑往返时间
+ */
+static void upstream_on_answer(forwarder_t* fwd, upstream_t* up, uint64_t rtt_us) {
+    if (!up->measured) {
+        up->srtt_us = (uint32_t)rtt_us;
+        up->rttvar_us = (uint32_t)rtt_us / 2;
+        up->measured = true;
+    } else {
+        uint32_t delta = (uint32_t)(rtt_us > up->srtt_us ? rtt_us - up->srtt_us : up->srtt_us - rtt_us);
+        up->rttvar_us = up->rttvar_us - up->rttvar_us / 4 + delta / 4;
+        up->srtt_us = up->srtt_us - up->srtt_us / 8 + (uint32_t)(rtt_us / 8);
+    }
+    upstream_add_sample(up, (uint32_t)rtt_us);
+    bool was_healthy = upstream_healthy(up);
+    up->fail_score -= up->fail_score / 4;
+    up->last_sample_ms = hloop_now_ms(fwd->loop);
+    ++up->answers;
+    if (!was_healthy && upstream_healthy(up)) {
+        hlogi("Upstream %s is back", up->name);
+    }
+}
+
+/**
+ * @brief 记录一次超时，失败分数向上限靠近
+ */
+static void upstream_on_timeout(forwarder_t* fwd, upstream_t* up) {
+    bool was_healthy = upstream_healthy(up);
+    if (!up->measured) {
+        // 从未应答过的上游以等待过的初始超时作为往返时间，不再因 srtt 为0而被优先选中
+        up->srtt_us = MIN(FORWARDER_INITIAL_RTO, (uint32_t)fwd->config->rto) * 1000u;
+        up->rttvar_us = up->srtt_us / 2;
+        up->measured = true;
+    } else {
+        // 超时按指数退避抬高平滑往返时间，避免仍被优先选中
+        up->srtt_us = MIN(MAX(up->srtt_us * 2, FORWARDER_MIN_RTO * 1000u), (uint32_t)fwd->config->rto * 1000u);
+    }
+    up->fail_score += (FORWARDER_FAIL_MAX - up->fail_score) / 4;
+    up->last_sample_ms = hloop_now_ms(fwd->loop);
+    ++up->timeouts;
+    if (was_healthy && !upstream_healthy(up)) {
+        hlogw("Upstream %s marked down", up->name);
+    }
+}
+
+/**
+ * @brief 选择尚未尝试过的最佳上游
+ *
+ * 优先选择健康且平滑往返时间最小的上游；所有上游都不健康时选择失败分数最低的。
+ *
+ * @param fwd 转发引擎
+ * @param exclude 不参与选择的上游位图
+ * @return 上游下标，没有可选上游时返回-1
+ */
+static int select_upstream(forwarder_t* fwd, uint32_t exclude) {
+    int best = -1;
+    for (int i = 0; i < fwd->nupstream; ++i) {
+        if (exclude & (1u << i)) continue;
+        upstream_t* up = &fwd->upstreams[i];
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        upstream_t* cur = &fwd->upstreams[best];
+        if (upstream_healthy(up) != upstream_healthy(cur)) {
+            if (upstream_healthy(up)) best = i;
+        } else if (!upstream_healthy(up)) {
+            if (up->fail_score < cur->fail_score) best = i;
+        } else if (up->srtt_us < cur->srtt_us) {
+            // 尚未测量的上游 srtt 为0，会被优先尝试一次；超时后以初始超时作为 srtt
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void free_query(forward_query_t* q) {
+    if (q->timer) htimer_del(q->timer);
+    if (q->hedge_timer) htimer_del(q->hedge_timer);
+    SAFE_FREE(q->buf);
+    free(q);
+}
+
+/**
+ * @brief 从在途查询表中摘除查询，释放资源后回调
+ */
+static void finish_query(forward_query_t* q, int status, char* buf, int len) {
+    forwarder_t* fwd = q->fwd;
+    fwd->pending[q->id] = NULL;
+    --fwd->npending;
+    bool reap = false;
+    for (int i = 0; i < 2; ++i) {
+        upstream_sock_t* sock = q->socks[i];
+        if (sock && --sock->npending == 0 && sock->retired) reap = true;
+    }
+    if (reap) sock_reap(fwd);
+    forward_cb cb = q->cb;
+    void* userdata = q->userdata;
+    free_query(q);
+    if (cb) cb(userdata, status, buf, len);
+}
+
+/**
+ * @brief 将查询报文发往指定上游，不改变当前等待的上游
+ *
+ * @return 成功时返回0
+ */
+static int send_packet(forward_query_t* q, int index) {
+    forwarder_t* fwd = q->fwd;
+    upstream_t* up = &fwd->upstreams[index];
+    int family = FAMILY_INDEX(up->addr.sa.sa_family);
+    if (q->socks[family] == NULL) {
+        q->socks[family] = fwd->pool[family][rng_next(fwd) % FORWARDER_POOL_SIZE];
+        ++q->socks[family]->npending;
+    }
+    q->sent |= 1u << index;
+    q->sent_us[index] = hloop_now_us(fwd->loop);
+    ++up->queries;
+
+    int nsend = sendto(hio_fd(q->socks[family]->io), q->buf, q->len, 0, &up->addr.sa, sockaddr_len(&up->addr));
+    if (nsend != q->len) {
+        hloge("Failed to send query to upstream %s", up->name);
+        return ERR_SENDTO;
+    }
+    return 0;
+}
+
+/**
+ * @brief 将查询报文发往指定上游，作为当前等待的上游并设置单次重传超时定时器
+ *
+ * @return 成功时返回0
+ */
+static int send_to_upstream(forward_query_t* q, int index) {
+    forwarder_t* fwd = q->fwd;
+    q->current = index;
+    int ret = send_packet(q, index);
+    if (ret != 0) {
+        return ret;
+    }
+
+    uint64_t now_us = hloop_now_us(fwd->loop);
+    uint32_t timeout = upstream_rto(fwd, &fwd->upstreams[index]);
+    if (q->deadline_us > now_us && (q->deadline_us - now_us) / 1000 < timeout) {
+        timeout = (uint32_t)((q->deadline_us - now_us + 999) / 1000);
+    }
+    if (q->timer) htimer_del(q->timer);
+    q->timer = htimer_add(fwd->loop, on_query_timeout, timeout, 1);
+    hevent_set_userdata(q->timer, q);
+    return 0;
+}
+
+/**
+ * @brief 给发送过但尚未记过超时的上游记一次超时
+ */
+static void charge_timeout(forward_query_t* q, int index) {
+    if (q->charged & (1u << index)) return;
+    q->charged |= 1u << index;
+    upstream_on_timeout(q->fwd, &q->fwd->upstreams[index]);
+}
+
+/**
+ * @brief 创建在途查询并登记到在途查询表
+ */
+static forward_query_t* new_query(forwarder_t* fwd, const char* buf, int len, int qlen, forward_cb cb, void* userdata) {
+    forward_query_t* q;
+    SAFE_ALLOC(q, sizeof(forward_query_t));
+    q->fwd = fwd;
+    q->id = alloc_id(fwd);
+    q->cb = cb;
+    q->userdata = userdata;
+    q->len = len;
+    q->qlen = qlen;
+    q->failover = true;
+    SAFE_ALLOC(q->buf, len);
+    memcpy(q->buf, buf, len);
+    q->orig_id = ntohs(((dnshdr_t*)q->buf)->transaction_id);
+    ((dnshdr_t*)q->buf)->transaction_id = htons(q->id);
+    q->deadline_us = hloop_now_us(fwd->loop) + (uint64_t)fwd->config->rto * 1000;
+    fwd->pending[q->id] = q;
+    ++fwd->npending;
+    return q;
+}
+
+/**
+ * @brief 开启对冲时，为首次发送的查询设置对冲定时器
+ *
+ * 阈值不小于单次重传超时时不对冲，交给故障转移处理。
+ */
+static void maybe_hedge(forwarder_t* fwd, forward_query_t* q) {
+    if (fwd->config->hedge_percent <= 0 || fwd->nupstream < 2) {
+        return;
+    }
+    fwd->hedge_tokens = MIN(fwd->hedge_tokens + fwd->config->hedge_percent / 100.0, FORWARDER_HEDGE_BURST);
+    upstream_t* up = &fwd->upstreams[q->current];
+    uint32_t threshold = upstream_hedge_ms(up);
+    if (threshold == 0 || threshold >= upstream_rto(fwd, up)) {
+        return;
+    }
+    q->hedge_timer = htimer_add(fwd->loop, on_hedge_timeout, threshold, 1);
+    hevent_set_userdata(q->hedge_timer, q);
+}
+
+/**
+ * @brief 借一个真实查询向最久没有样本的非首选上游发送探测
+ *
+ * 探测使用独立的事务ID，应答只用于更新该上游的状态，不影响原查询。
+ */
+static void maybe_probe(forwarder_t* fwd, forward_query_t* q) {
+    uint64_t now_ms = hloop_now_ms(fwd->loop);
+    if (fwd->nupstream < 2 || now_ms - fwd->last_probe_ms < FORWARDER_PROBE_MS ||
+        fwd->npending >= FORWARDER_MAX_PENDING) {
+        return;
+    }
+    int target = -1;
+    for (int i = 0; i < fwd->nupstream; ++i) {
+        if (i == q->current) continue;
+        if (target < 0 || fwd->upstreams[i].last_sample_ms < fwd->upstreams[target].last_sample_ms) {
+            target = i;
+        }
+    }
+    fwd->last_probe_ms = now_ms;
+    forward_query_t* probe = new_query(fwd, q->buf, q->len, q->qlen, NULL, NULL);
+    probe->failover = false;
+    hlogd("Probing upstream %s", fwd->upstreams[target].name);
+    if (send_to_upstream(probe, target) != 0) {
+        finish_query(probe, ERR_SENDTO, NULL, 0);
+    }
+}
+
+forwarder_t* forwarder_create(hloop_t* loop, struct Config* config) {
+    forwarder_t* fwd;
+    SAFE_ALLOC(fwd, sizeof(forwarder_t));
+    fwd->loop = loop;
+    fwd->config = config;
+    rng_seed(fwd);
+
+    bool families[2] = {false, false};
+    for (int i = 0; i < config->dns_server_count && i < MAX_DNS_SERVERS; ++i) {
+        upstream_t* up = &fwd->upstreams[fwd->nupstream];
+        if (parse_upstream(config->dns_servers[i], &up->addr) != 0) {
+            hloge("Invalid upstream address: %s", config->dns_servers[i]);
+            free(fwd);
+            return NULL;
+        }
+        sockaddr_str(&up->addr, up->name, sizeof(up->name));
+        families[FAMILY_INDEX(up->addr.sa.sa_family)] = true;
+        ++fwd->nupstream;
+    }
+    if (fwd->nupstream == 0) {
+        hloge("No upstream DNS server configured");
+        free(fwd);
+        return NULL;
+    }
+
+    for (int f = 0; f < 2; ++f) {
+        if (!families[f]) continue;
+        for (int i = 0; i < FORWARDER_POOL_SIZE; ++i) {
+            fwd->pool[f][i] = sock_open(fwd, f ? AF_INET6 : AF_INET);
+            if (fwd->pool[f][i] == NULL) {
+                forwarder_destroy(fwd);
+                return NULL;
+            }
+        }
+    }
+    fwd->rotate_timer = htimer_add(loop, on_rotate, FORWARDER_ROTATE_MS, INFINITE);
+    hevent_set_userdata(fwd->rotate_timer, fwd);
+    return fwd;
+}
+
+void forwarder_destroy(forwarder_t* fwd) {
+    if (fwd == NULL) return;
+    for (int i = 0; i < FORWARDER_MAX_PENDING && fwd->npending > 0; ++i) {
+        if (fwd->pending[i]) {
+            finish_query(fwd->pending[i], ECANCELED, NULL, 0);
+        }
+    }
+    if (fwd->rotate_timer) htimer_del(fwd->rotate_timer);
+    for (int f = 0; f < 2; ++f) {
+        for (int i = 0; i < FORWARDER_POOL_SIZE; ++i) {
+            if (fwd->pool[f][i]) sock_close(fwd->pool[f][i]);
+        }
+    }
+    sock_reap(fwd);
+    free(fwd);
+}
+
+int forwarder_query(forwarder_t* fwd, const char* buf, int len, forward_cb cb, void* userdata) {
+    int qlen = dns_question_len(buf, len);
+    if (qlen < 0) {
+        return -ERR_INVALID_PACKAGE;
+    }
+    if (fwd->npending >= FORWARDER_MAX_PENDING) {
+        hlogw("Too many pending upstream queries");
+        return ERR_OVER_LIMIT;
+    }
+
+    forward_query_t* q = new_query(fwd, buf, len, qlen, cb, userdata);
+    // 发送失败时立即转移到下一个上游
+    int index;
+    while ((index = select_upstream(fwd, q->sent)) >= 0) {
+        if (send_to_upstream(q, index) == 0) {
+            maybe_hedge(fwd, q);
+            maybe_probe(fwd, q);
+            return 0;
+        }
+    }
+    q->cb = NULL;
+    finish_query(q, ERR_SENDTO, NULL, 0);
+    return ERR_SENDTO;
+}
+
+int forwarder_get_stats(forwarder_t* fwd, upstream_stats_t* stats, int nstats) {
+    int n = MIN(nstats, fwd->nupstream);
+    for (int i = 0; i < n; ++i) {
+        upstream_t* up = &fwd->upstreams[i];
+        upstream_stats_t* st = &stats[i];
+        memset(st, 0, sizeof(upstream_stats_t));
+        strncpy(st->name, up->name, sizeof(st->name) - 1);
+        st->healthy = upstream_healthy(up);
+        st->srtt_us = up->srtt_us;
+        st->rttvar_us = up->rttvar_us;
+        st->fail_score = up->fail_score;
+        st->queries = up->queries;
+        st->answers = up->answers;
+        st->timeouts = up->timeouts;
+        st->p95_us = up->p95_us;
+        st->hedged = up->hedged;
+        st->hedge_wins = up->hedge_wins;
+    }
+    return n;
+}
+
+/**
+ * @brief 上游应答回调，按事务ID匹配在途查询
+ *
+ * @param io 上游 I/O 对象
+ * @param buf 缓冲区
+ * @param readbytes 读取字节数
+ */
+static void on_upstream_recv(hio_t* io, void* buf, int readbytes) {
+    upstream_sock_t* sock = (upstream_sock_t*)hio_context(io);
+    forwarder_t* fwd = sock->fwd;
+    if (readbytes < (int)sizeof(dnshdr_t)) return;
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    if (hdr->qr != DNS_RESPONSE) return;
+
+    uint16_t id = ntohs(hdr->transaction_id);
+    forward_query_t* q = fwd->pending[id];
+    if (q == NULL || q->socks[FAMILY_INDEX(sock->family)] != sock) {
+        hlogd("Dropped upstream response with unknown id %u", id);
+        return;
+    }
+    // 应答必须来自已发送过该查询的上游，且问题部分与查询一致
+    int index;
+    for (index = 0; index < fwd->nupstream; ++index) {
+        if ((q->sent & (1u << index)) &&
+            sockaddr_equal((sockaddr_u*)hio_peeraddr(io), &fwd->upstreams[index].addr)) {
+            break;
+        }
+    }
+    if (index == fwd->nupstream) {
+        hlogw("Dropped upstream response from unexpected address");
+        return;
+    }
+    if (readbytes < (int)sizeof(dnshdr_t) + q->qlen ||
+        !question_equal((char*)buf + sizeof(dnshdr_t), q->buf + sizeof(dnshdr_t), q->qlen)) {
+        hlogw("Dropped upstream response with mismatched question, id %u", id);
+        return;
+    }
+
+    upstream_on_answer(fwd, &fwd->upstreams[index], hloop_now_us(fwd->loop) - q->sent_us[index]);
+    if (q->hedged & (1u << index)) {
+        ++fwd->upstreams[index].hedge_wins;
+    }
+    hdr->transaction_id = htons(q->orig_id);
+    finish_query(q, 0, (char*)buf, readbytes);
+}
+
+/**
+ * @brief 单次重传超时回调
+ *
+ * 当前上游记一次超时，若整个查询尚未到期则转移到下一个上游，
+ * 之前发出的查询仍然有效，先到的合法应答胜出；整个查询到期时所有没有应答的上游都记一次超时。
+ *
+ * @param timer 定时器
+ */
+static void on_query_timeout(htimer_t* timer) {
+    forward_query_t* q = (forward_query_t*)hevent_userdata(timer);
+    forwarder_t* fwd = q->fwd;
+    q->timer = NULL; // 一次性定时器触发后由事件循环回收
+
+    upstream_t* up = &fwd->upstreams[q->current];
+    charge_timeout(q, q->current);
+
+    uint64_t now_us = hloop_now_us(fwd->loop);
+    if (now_us < q->deadline_us) {
+        int index;
+        while (q->failover && (index = select_upstream(fwd, q->sent)) >= 0) {
+            hlogd("Upstream %s timed out, failing over to %s", up->name, fwd->upstreams[index].name);
+            if (send_to_upstream(q, index) == 0) return;
+        }
+        // 没有可转移的上游，等待已发出的查询直到截止时间
+        uint32_t remain = (uint32_t)((q->deadline_us - now_us + 999) / 1000);
+        q->timer = htimer_add(fwd->loop, on_query_timeout, remain, 1);
+        hevent_set_userdata(q->timer, q);
+        return;
+    }
+    // 整个查询到期，对冲目标等所有没有应答的上游都记一次超时
+    for (int i = 0; i < fwd->nupstream; ++i) {
+        if (q->sent & (1u << i)) charge_timeout(q, i);
+    }
+    hlogd("Upstream query %u timed out", q->id);
+    finish_query(q, ETIMEDOUT, NULL, 0);
+}
+
+/**
+ * @brief 对冲定时器回调
+ *
+ * 首选上游在对冲阈值内没有应答，且令牌桶有余量时，把同一个查询发给次优上游。
+ * 两边使用相同的事务ID，先到的合法应答胜出，后到的因找不到在途查询而被丢弃。
+ *
+ * @param timer 定时器
+ */
+static void on_hedge_timeout(htimer_t* timer) {
+    forward_query_t* q = (forward_query_t*)hevent_userdata(timer);
+    forwarder_t* fwd = q->fwd;
+    q->hedge_timer = NULL;
+    if (fwd->hedge_tokens < 1) {
+        return;
+    }
+    int index = select_upstream(fwd, q->sent);
+    if (index < 0) {
+        return;
+    }
+    fwd->hedge_tokens -= 1;
+    q->hedged |= 1u << index;
+    ++fwd->upstreams[index].hedged;
+    hlogd("Hedging query %u to upstream %s", q->id, fwd->upstreams[index].name);
+    // 仍等待首选上游：单次重传超时按首选上游计时，超时也记在它身上
+    send_packet(q, index);
+}
+
+/**
+ * @brief 套接字轮换定时器回调
+ *
+ * 每次用新的随机源端口替换各协议族池中的一个套接字，旧套接字不再承接新查询，
+ * 在其在途查询全部完成或超时后关闭。
+ *
+ * @param timer 定时器
+ */
+static void on_rotate(htimer_t* timer) {
+    forwarder_t* fwd = (forwarder_t*)hevent_userdata(timer);
+    for (int f = 0; f < 2; ++f) {
+        upstream_sock_t* old = fwd->pool[f][fwd->rotate_index];
+        if (old == NULL) continue;
+        upstream_sock_t* sock = sock_open(fwd, old->family);
+        if (sock == NULL) continue;
+        fwd->pool[f][fwd->rotate_index] = sock;
+        old->retired = true;
+        old->next = fwd->retired;
+        fwd->retired = old;
+    }
+    fwd->rotate_index = (fwd->rotate_index + 1) % FORWARDER_POOL_SIZE;
+    sock_reap(fwd);
+}
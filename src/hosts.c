@@ -0,0 +1,241 @@
+#include "hosts.h"
+#include "dns.h"
+#include <hv/hplatform.h>
+#include <hv/hdef.h>
+#include <hv/hlog.h>
+#include <hv/hthread.h>
+#include <hv/hsysinfo.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// 每个线程至少解析的字节数，小文件不值得启动线程
+#define CHUNK_MINSIZE   (1 << 20)
+#define MAX_THREADS     64
+// 单个字段的最大长度，足够容纳 ||域名^
+#define TOKEN_MAXLEN    260
+
+// 一个线程解析的块，范围在行边界上
+typedef struct hosts_chunk_t {
+    const char*             begin;
+    const char*             end;
+    blocklist_builder_t*    builder;
+    hosts_record_t*         records;
+    int                     nrecords, cap;
+    size_t                  lines;
+    hthread_t               thread;
+} hosts_chunk_t;
+
+// 取出 [p, end) 中的下一个以空格或制表符分隔的字段，复制到 token 中，返回字段之后的位置
+static const char* next_token(const char* p, const char* end, char* token, size_t* len) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    const char* start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+    *len = p - start;
+    if (*len >= TOKEN_MAXLEN) {
+        // 过长的字段只保留开头用于日志，长度保留以便调用者判断为不合法
+        memcpy(token, start, TOKEN_MAXLEN - 1);
+        token[TOKEN_MAXLEN - 1] = '\0';
+    } else {
+        memcpy(token, start, *len);
+        token[*len] = '\0';
+    }
+    return p;
+}
+
+// 追加一条本地记录，域名去掉末尾的点
+static hosts_record_t* add_record(hosts_chunk_t* chunk, const char* name, uint16_t type) {
+    if (chunk->nrecords == chunk->cap) {
+        chunk->cap = chunk->cap ? chunk->cap * 2 : 64;
+        chunk->records = (hosts_record_t*)realloc(chunk->records, sizeof(hosts_record_t) * chunk->cap);
+    }
+    hosts_record_t* record = &chunk->records[chunk->nrecords++];
+    memset(record, 0, sizeof(hosts_record_t));
+    record->name = strdup(name);
+    size_t len = strlen(name);
+    if (len > 1 && name[len - 1] == '.') record->name[len - 1] = '\0';
+    record->type = type;
+    return record;
+}
+
+static void parse_line(hosts_chunk_t* chunk, const char* line, const char* end) {
+    char ip[TOKEN_MAXLEN], domain[TOKEN_MAXLEN], target[TOKEN_MAXLEN];
+    size_t ip_len, domain_len, target_len;
+    line = next_token(line, end, ip, &ip_len);
+    line = next_token(line, end, domain, &domain_len);
+
+    // 空行和注释行
+    if (ip_len == 0 || ip[0] == '#' || ip[0] == '!') {
+        return;
+    }
+    // 单独一行的 ||example.com^ 规则
+    if (domain_len == 0) {
+        if (strncmp(ip, "||", 2) == 0 &&
+            (ip_len >= TOKEN_MAXLEN || blocklist_builder_add(chunk->builder, ip) != 0)) {
+            hlogw("Invalid blacklist rule: %s", ip);
+        }
+        return;
+    }
+
+    if (strcmp(ip, "0.0.0.0") == 0) {
+        if (domain_len >= TOKEN_MAXLEN || blocklist_builder_add(chunk->builder, domain) != 0) {
+            hlogw("Invalid blacklist rule: %s", domain);
+        }
+        return;
+    }
+    if (ip_len >= TOKEN_MAXLEN || domain_len >= TOKEN_MAXLEN) {
+        hlogw("Invalid local record: %s %s", ip, domain);
+        return;
+    }
+    // 别名记录：域名 CNAME 目标
+    if (strcasecmp(domain, "CNAME") == 0) {
+        next_token(line, end, target, &target_len);
+        if (target_len == 0 || target_len >= TOKEN_MAXLEN) {
+            hlogw("Invalid CNAME target for %s", ip);
+            return;
+        }
+        hosts_record_t* record = add_record(chunk, ip, DNS_TYPE_CNAME);
+        record->target = strdup(target);
+        return;
+    }
+    uint8_t addr[16];
+    if (inet_pton(AF_INET, ip, addr) == 1) {
+        memcpy(add_record(chunk, domain, DNS_TYPE_A)->addr, addr, 4);
+    } else if (inet_pton(AF_INET6, ip, addr) == 1) {
+        memcpy(add_record(chunk, domain, DNS_TYPE_AAAA)->addr, addr, 16);
+    } else {
+        hlogw("Invalid address %s for %s", ip, domain);
+    }
+}
+
+static void parse_chunk(hosts_chunk_t* chunk) {
+    const char* p = chunk->begin;
+    while (p < chunk->end) {
+        const char* eol = (const char*)memchr(p, '\n', chunk->end - p);
+        if (eol == NULL) eol = chunk->end;
+        parse_line(chunk, p, eol);
+        ++chunk->lines;
+        p = eol + 1;
+    }
+    blocklist_builder_sort(chunk->builder);
+}
+
+static HTHREAD_ROUTINE(parse_thread) {
+    parse_chunk((hosts_chunk_t*)userdata);
+    return (HTHREAD_RETTYPE)0;
+}
+
+// 并行解析 data 中的规则
+static void parse_hosts(const char* data, size_t size, hosts_t* hosts) {
+    int nthreads = (int)MIN((size_t)get_ncpu(), size / CHUNK_MINSIZE + 1);
+    nthreads = MAX(1, MIN(nthreads, MAX_THREADS));
+
+    // 按字节均分，再把每个边界后移到下一行的开头
+    hosts_chunk_t* chunks = (hosts_chunk_t*)calloc(nthreads, sizeof(hosts_chunk_t));
+    const char* end = data + size;
+    const char* p = data;
+    for (int i = 0; i < nthreads; ++i) {
+        chunks[i].begin = p;
+        if (i == nthreads - 1) {
+            p = end;
+        } else {
+            const char* q = MAX(p, data + size / nthreads * (i + 1));
+            const char* eol = q < end ? (const char*)memchr(q, '\n', end - q) : NULL;
+            p = eol ? eol + 1 : end;
+        }
+        chunks[i].end = p;
+        chunks[i].builder = blocklist_builder_create();
+    }
+
+    // 第一块在当前线程中解析
+    for (int i = 1; i < nthreads; ++i) {
+        chunks[i].thread = hthread_create(parse_thread, &chunks[i]);
+    }
+    parse_chunk(&chunks[0]);
+    for (int i = 1; i < nthreads; ++i) {
+        hthread_join(chunks[i].thread);
+    }
+
+    // 按块的顺序拼接本地记录，保持文件中的顺序
+    blocklist_builder_t* builders[MAX_THREADS];
+    int nrecords = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        nrecords += chunks[i].nrecords;
+    }
+    hosts->records = (hosts_record_t*)malloc(sizeof(hosts_record_t) * MAX(nrecords, 1));
+    hosts->nrecords = 0;
+    hosts->lines = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        memcpy(hosts->records + hosts->nrecords, chunks[i].records, sizeof(hosts_record_t) * chunks[i].nrecords);
+        hosts->nrecords += chunks[i].nrecords;
+        hosts->lines += chunks[i].lines;
+        free(chunks[i].records);
+        builders[i] = chunks[i].builder;
+    }
+    hosts->blacklist = blocklist_build_merged(builders, nthreads);
+    hosts->bytes = size;
+    hosts->threads = nthreads;
+    free(chunks);
+}
+
+int hosts_load(const char* filename, hosts_t* hosts) {
+    memset(hosts, 0, sizeof(hosts_t));
+#ifdef OS_UNIX
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        parse_hosts("", 0, hosts);
+        return 0;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    parse_hosts((const char*)data, st.st_size, hosts);
+    munmap(data, st.st_size);
+    return 0;
+#else
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(size > 0 ? size : 1);
+    int ret = -1;
+    if (size >= 0 && fread(data, 1, size, file) == (size_t)size) {
+        parse_hosts(data, size, hosts);
+        ret = 0;
+    }
+    free(data);
+    fclose(file);
+    return ret;
+#endif
+}
+
+void hosts_free(hosts_t* hosts) {
+    blocklist_destroy(hosts->blacklist);
+    for (int i = 0; i < hosts->nrecords; ++i) {
+        free(hosts->records[i].name);
+        free(hosts->records[i].target);
+    }
+    free(hosts->records);
+    memset(hosts, 0, sizeof(hosts_t));
+}
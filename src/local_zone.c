@@ -0,0 +1,280 @@
+#include "local_zone.h"
+#include "dns.h"
+#include "bloom.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 预先打包的应答按查询类型分类
+enum {
+    ZONE_ANSWER_A,
+    ZONE_ANSWER_AAAA,
+    ZONE_ANSWER_CNAME,
+    ZONE_ANSWER_OTHER,      // 其他类型：CNAME 域名只应答 CNAME 链，否则为 NODATA
+    ZONE_ANSWER_TYPES
+};
+
+#define CNAME_MAXDEPTH  8
+#define FILTER_BITS_PER_KEY 10
+
+typedef struct zone_answer_t {
+    uint32_t data;          // 记录部分在 zone->data 中的偏移
+    uint16_t len;
+    uint16_t nanswer;
+} zone_answer_t;
+
+typedef struct zone_entry_t {
+    char* name;             // 小写，不带末尾的点
+    uint32_t hash;          // hash_name 的低32位
+    int first, count;       // 本域名的记录在 zone->records 中的范围
+    char* cname;            // CNAME 目标，没有时为 NULL；只在构建期间使用
+    zone_answer_t answers[ZONE_ANSWER_TYPES];
+} zone_entry_t;
+
+struct local_zone_s {
+    zone_entry_t* entries;
+    int nentries;
+    uint32_t* slots;        // 开放寻址的哈希表，保存条目下标加一，0 表示空槽位
+    uint32_t mask;
+    bloom_t filter;         // 域名的布隆过滤器，不在本地区域中的域名通常只需读一条缓存行
+    const hosts_record_t** records; // 按域名分组的记录，只在构建期间使用
+    char* data;             // 所有预先打包的记录部分
+    size_t data_len, data_cap;
+    uint32_t ttl;
+};
+
+// 不区分大小写的 64 位 FNV-1a，低32位用于哈希表，整体用于布隆过滤器
+static uint64_t hash_name(const char* name) {
+    uint64_t hash = BLOOM_HASH_INIT;
+    for (const char* p = name; *p; ++p) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*p)) * BLOOM_HASH_PRIME;
+    }
+    return hash;
+}
+
+static const zone_entry_t* find_entry(const local_zone_t* zone, const char* name, uint64_t hash) {
+    if (!bloom_may_contain(&zone->filter, hash)) return NULL;
+    for (uint32_t pos = (uint32_t)hash & zone->mask;; pos = (pos + 1) & zone->mask) {
+        uint32_t slot = zone->slots[pos];
+        if (slot == 0) return NULL;
+        const zone_entry_t* entry = &zone->entries[slot - 1];
+        if (entry->hash == (uint32_t)hash && strcasecmp(entry->name, name) == 0) return entry;
+    }
+}
+
+// 记录按域名排序，同一域名的记录保持在文件中的顺序
+static int compare_records(const void* a, const void* b) {
+    const hosts_record_t* ra = *(const hosts_record_t* const*)a;
+    const hosts_record_t* rb = *(const hosts_record_t* const*)b;
+    int cmp = strcasecmp(ra->name, rb->name);
+    if (cmp != 0) return cmp;
+    return ra < rb ? -1 : ra > rb;
+}
+
+// 去掉末尾的点并转为小写，域名不合法时返回 NULL
+static char* normalize_name(const char* name) {
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '.') --len;
+    if (len == 0 || len > 253) return NULL;
+    char* out = (char*)malloc(len + 1);
+    size_t label = 0;
+    for (size_t i = 0; i < len; ++i) {
+        out[i] = (char)tolower((unsigned char)name[i]);
+        label = out[i] == '.' ? 0 : label + 1;
+        if (label > 63 || (out[i] == '.' && (i == 0 || out[i - 1] == '.'))) {
+            free(out);
+            return NULL;
+        }
+    }
+    out[len] = '\0';
+    return out;
+}
+
+/**
+ * @brief 把 entry 对应 kind 类查询的记录追加到 out
+ *
+ * @param owner 记录所有者域名在报文中的偏移，写作压缩指针
+ * @param base out 在报文中的偏移
+ * @param chain 已经过的 CNAME 链，用于发现环
+ */
+static void append_records(const local_zone_t* zone, const zone_entry_t* entry, int kind, uint16_t owner,
+                           int base, char* out, int* len, uint16_t* nanswer,
+                           const zone_entry_t** chain, int depth) {
+    uint8_t rr[12 + DNS_NAME_MAXLEN + 1];
+    rr[0] = 0xc0 | (owner >> 8);
+    rr[1] = owner & 0xff;
+    rr[4] = 0;
+    rr[5] = DNS_CLASS_IN;
+    uint32_t ttl = htonl(zone->ttl);
+    memcpy(rr + 6, &ttl, 4);
+
+    if (entry->cname != NULL) {
+        int rdlen = dns_name_encode(entry->cname, (char*)rr + 12);
+        rr[2] = 0;
+        rr[3] = DNS_TYPE_CNAME;
+        rr[10] = rdlen >> 8;
+        rr[11] = rdlen & 0xff;
+        if (*len + 12 + rdlen > 512 - base) return;
+        uint16_t target_owner = (uint16_t)(base + *len + 12);
+        memcpy(out + *len, rr, 12 + rdlen);
+        *len += 12 + rdlen;
+        ++*nanswer;
+        const zone_entry_t* target = find_entry(zone, entry->cname, hash_name(entry->cname));
+        if (kind == ZONE_ANSWER_CNAME || target == NULL || depth == CNAME_MAXDEPTH) return;
+        chain[depth] = entry;
+        for (int i = 0; i <= depth; ++i) {
+            if (chain[i] == target) return;
+        }
+        append_records(zone, target, kind, target_owner, base, out, len, nanswer, chain, depth + 1);
+        return;
+    }
+
+    uint16_t rtype = kind == ZONE_ANSWER_A ? DNS_TYPE_A : kind == ZONE_ANSWER_AAAA ? DNS_TYPE_AAAA : 0;
+    int rdlen = rtype == DNS_TYPE_A ? 4 : 16;
+    for (int i = entry->first; rtype != 0 && i < entry->first + entry->count; ++i) {
+        const hosts_record_t* record = zone->records[i];
+        if (record->type != rtype) continue;
+        // 超出512字节的记录被丢弃
+        if (*len + 12 + rdlen > 512 - base) return;
+        rr[2] = rtype >> 8;
+        rr[3] = rtype & 0xff;
+        rr[10] = 0;
+        rr[11] = rdlen;
+        memcpy(rr + 12, record->addr, rdlen);
+        memcpy(out + *len, rr, 12 + rdlen);
+        *len += 12 + rdlen;
+        ++*nanswer;
+    }
+}
+
+static void pack_answers(local_zone_t* zone, zone_entry_t* entry) {
+    // 客户端问题与条目的域名长度相同，记录部分在报文中的偏移因此是确定的
+    int base = (int)sizeof(dnshdr_t) + (int)strlen(entry->name) + 2 + 4;
+    for (int kind = 0; kind < ZONE_ANSWER_TYPES; ++kind) {
+        char out[512];
+        int len = 0;
+        uint16_t nanswer = 0;
+        const zone_entry_t* chain[CNAME_MAXDEPTH];
+        append_records(zone, entry, kind, sizeof(dnshdr_t), base, out, &len, &nanswer, chain, 0);
+        if (zone->data_len + len > zone->data_cap) {
+            zone->data_cap = zone->data_cap ? zone->data_cap * 2 : 4096;
+            while (zone->data_cap < zone->data_len + len) zone->data_cap *= 2;
+            zone->data = (char*)realloc(zone->data, zone->data_cap);
+        }
+        memcpy(zone->data + zone->data_len, out, len);
+        entry->answers[kind].data = (uint32_t)zone->data_len;
+        entry->answers[kind].len = (uint16_t)len;
+        entry->answers[kind].nanswer = nanswer;
+        zone->data_len += len;
+    }
+}
+
+local_zone_t* local_zone_create(const hosts_record_t* records, int nrecords, uint32_t ttl) {
+    local_zone_t* zone = (local_zone_t*)calloc(1, sizeof(local_zone_t));
+    zone->ttl = ttl;
+    zone->records = (const hosts_record_t**)malloc(sizeof(hosts_record_t*) * (nrecords > 0 ? nrecords : 1));
+    for (int i = 0; i < nrecords; ++i) {
+        zone->records[i] = &records[i];
+    }
+    qsort(zone->records, nrecords, sizeof(hosts_record_t*), compare_records);
+
+    // 每个域名一个条目
+    zone->entries = (zone_entry_t*)calloc(nrecords > 0 ? nrecords : 1, sizeof(zone_entry_t));
+    for (int i = 0, j; i < nrecords; i = j) {
+        for (j = i + 1; j < nrecords && strcasecmp(zone->records[i]->name, zone->records[j]->name) == 0; ++j);
+        char* name = normalize_name(zone->records[i]->name);
+        if (name == NULL) {
+            hlogw("Invalid local record name: %s", zone->records[i]->name);
+            continue;
+        }
+        zone_entry_t* entry = &zone->entries[zone->nentries++];
+        entry->name = name;
+        entry->hash = (uint32_t)hash_name(name);
+        entry->first = i;
+        entry->count = j - i;
+        for (int k = i; k < j; ++k) {
+            if (zone->records[k]->type != DNS_TYPE_CNAME) continue;
+            if (entry->cname == NULL) {
+                entry->cname = normalize_name(zone->records[k]->target);
+                if (entry->cname == NULL) {
+                    hlogw("Invalid CNAME target %s for %s", zone->records[k]->target, name);
+                }
+            } else {
+                hlogw("Ignoring extra CNAME %s for %s", zone->records[k]->target, name);
+            }
+        }
+        if (entry->cname != NULL && entry->count > 1) {
+            hlogw("%s has a CNAME record, its other records are ignored", name);
+        }
+    }
+
+    uint32_t nslots = 16;
+    while (nslots < (uint32_t)zone->nentries * 2) nslots <<= 1;
+    zone->slots = (uint32_t*)calloc(nslots, sizeof(uint32_t));
+    zone->mask = nslots - 1;
+    bloom_init(&zone->filter, zone->nentries, FILTER_BITS_PER_KEY);
+    for (int i = 0; i < zone->nentries; ++i) {
+        uint32_t pos = zone->entries[i].hash & zone->mask;
+        while (zone->slots[pos] != 0) pos = (pos + 1) & zone->mask;
+        zone->slots[pos] = (uint32_t)i + 1;
+        bloom_add(&zone->filter, hash_name(zone->entries[i].name));
+    }
+
+    // 所有条目都进入哈希表后才能跟随 CNAME
+    for (int i = 0; i < zone->nentries; ++i) {
+        pack_answers(zone, &zone->entries[i]);
+    }
+    // 打包完成后不再需要记录和 CNAME 目标
+    for (int i = 0; i < zone->nentries; ++i) {
+        free(zone->entries[i].cname);
+        zone->entries[i].cname = NULL;
+    }
+    free(zone->records);
+    zone->records = NULL;
+    return zone;
+}
+
+void local_zone_destroy(local_zone_t* zone) {
+    if (zone == NULL) return;
+    for (int i = 0; i < zone->nentries; ++i) {
+        free(zone->entries[i].name);
+    }
+    free(zone->entries);
+    free(zone->slots);
+    bloom_free(&zone->filter);
+    free(zone->data);
+    free(zone);
+}
+
+int local_zone_size(const local_zone_t* zone) {
+    return zone->nentries;
+}
+
+int local_zone_answer(const local_zone_t* zone, const char* query, int qlen, const char* name,
+                      uint16_t rtype, uint16_t rclass, char* buf) {
+    if (rclass != DNS_CLASS_IN) return 0;
+    const zone_entry_t* entry = find_entry(zone, name, hash_name(name));
+    if (entry == NULL) return 0;
+
+    int kind = rtype == DNS_TYPE_A ? ZONE_ANSWER_A :
+               rtype == DNS_TYPE_AAAA ? ZONE_ANSWER_AAAA :
+               rtype == DNS_TYPE_CNAME ? ZONE_ANSWER_CNAME : ZONE_ANSWER_OTHER;
+    const zone_answer_t* answer = &entry->answers[kind];
+    int off = sizeof(dnshdr_t) + qlen;
+    if (off + answer->len > 512) return 0;
+
+    memcpy(buf, query, off);
+    memcpy(buf + off, zone->data + answer->data, answer->len);
+    dnshdr_t* hdr = (dnshdr_t*)buf;
+    hdr->qr = DNS_RESPONSE;
+    hdr->aa = 1;
+    hdr->tc = 0;
+    hdr->ra = 1;
+    hdr->res = 0;
+    hdr->ad = 0;
+    hdr->rcode = 0;
+    hdr->nanswer = htons(answer->nanswer);
+    hdr->nauthority = 0;
+    hdr->naddtional = 0;
+    return off + answer->len;
+}
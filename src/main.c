@@ -6,9 +6,16 @@
 // 全局变量，用于在清理函数中访问DNS服务器实例
 dns_server_t server;
 
-// 清理函数，用于释放资源
+// 请求停止，事件循环退出后由 main 保存快照并释放资源
 static void cleanup(int status) {
-    dns_server_stop(&server);
+    (void)status;
+    dns_server_shutdown(&server);
+}
+
+// 重新加载规则文件
+static void reload(int status) {
+    (void)status;
+    dns_server_reload(&server);
 }
 
 int main(int argc, char **argv) {
@@ -18,15 +25,19 @@ int main(int argc, char **argv) {
     parse_args(argc, argv, &server_config);
     init_logger(&server_config);
 
-    // 注册清理函数
-    signal(SIGINT, cleanup);
-
     if(dns_server_init(&server, &server_config) != 0) {
         hloge("Failed to initialize DNS Server");
         return -1;
     }
 
+    // 初始化完成后再注册信号处理函数，此前唤醒管道和事件循环都还不存在
+    signal(SIGINT, cleanup);
+#ifdef SIGHUP
+    signal(SIGHUP, reload);
+#endif
+
     dns_server_start(&server);
+    dns_server_stop(&server);
 
     return 0;
 }
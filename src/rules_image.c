@@ -0,0 +1,300 @@
+#include "rules_image.h"
+#include "bloom.h"
+#include <hv/hplatform.h>
+#include <hv/hlog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * 镜像布局 (本机字节序)，各段按 64 字节 (缓存行) 对齐：
+ *   文件头
+ *   黑名单的布隆过滤器 filter_blocks * BLOOM_BLOCK_SIZE
+ *   黑名单节点    nnodes * BLOCKLIST_NODE_SIZE
+ *   本地记录      nrecords * sizeof(image_record_t)
+ *   黑名单字符串池 labels_len
+ *   本地记录域名  names_len，包括 CNAME 的目标，以 '\0' 分隔
+ */
+#define IMAGE_MAGIC         "DNSRRULE"
+#define IMAGE_BYTE_ORDER    0x01020304u
+#define IMAGE_ALIGN(n)      (((n) + 63) & ~(size_t)63)
+
+typedef struct image_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    // 用于识别在字节序不同的机器上编译的镜像
+    uint64_t size;          // 文件大小
+    uint64_t checksum;      // 文件头之后所有字节的校验和
+    uint32_t nnodes;
+    uint32_t nrecords;
+    uint64_t count;         // 黑名单规则数
+    uint64_t labels_len;
+    uint64_t names_len;
+    uint32_t filter_blocks;
+    uint32_t filter_k;
+} image_header_t;
+
+#define IMAGE_NO_TARGET     UINT32_MAX
+
+typedef struct image_record_t {
+    uint32_t name;          // 域名在域名段中的偏移
+    uint32_t target;        // CNAME 目标在域名段中的偏移，其他记录为 IMAGE_NO_TARGET
+    uint16_t type;
+    uint16_t reserved;
+    uint8_t addr[16];
+} image_record_t;
+
+struct rules_image_s {
+    char* data;
+    size_t size;
+};
+
+// 各段在镜像中的偏移
+typedef struct image_layout_t {
+    size_t filter, nodes, records, labels, names, size;
+} image_layout_t;
+
+static void get_layout(const image_header_t* header, image_layout_t* layout) {
+    layout->filter = IMAGE_ALIGN(sizeof(image_header_t));
+    layout->nodes = layout->filter + (size_t)header->filter_blocks * BLOOM_BLOCK_SIZE;
+    layout->records = layout->nodes + IMAGE_ALIGN((size_t)header->nnodes * BLOCKLIST_NODE_SIZE);
+    layout->labels = layout->records + IMAGE_ALIGN((size_t)header->nrecords * sizeof(image_record_t));
+    layout->names = layout->labels + IMAGE_ALIGN(header->labels_len);
+    layout->size = layout->names + IMAGE_ALIGN(header->names_len);
+}
+
+// FNV-1a，每次处理8个字节；各段长度都是64的倍数
+static uint64_t image_checksum(const char* data, size_t len) {
+    uint64_t hash = BLOOM_HASH_INIT;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * BLOOM_HASH_PRIME;
+    }
+    return hash;
+}
+
+bool rules_image_probe(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char magic[8];
+    bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+              memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return ok;
+}
+
+int rules_image_write(const char* filename, const hosts_t* hosts) {
+    blocklist_image_t blocklist;
+    blocklist_export(hosts->blacklist, &blocklist);
+
+    image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = RULES_IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.nnodes = blocklist.nnodes;
+    header.nrecords = (uint32_t)hosts->nrecords;
+    header.count = blocklist.count;
+    header.labels_len = blocklist.labels_len;
+    header.filter_blocks = blocklist.filter_blocks;
+    header.filter_k = blocklist.filter_k;
+    for (int i = 0; i < hosts->nrecords; ++i) {
+        header.names_len += strlen(hosts->records[i].name) + 1;
+        if (hosts->records[i].target != NULL) {
+            header.names_len += strlen(hosts->records[i].target) + 1;
+        }
+    }
+    image_layout_t layout;
+    get_layout(&header, &layout);
+    header.size = layout.size;
+
+    // 在内存中拼好整个镜像再一次写出
+    char* data = (char*)calloc(1, layout.size);
+    if (data == NULL) {
+        return -1;
+    }
+    if (blocklist.filter_blocks > 0) {
+        memcpy(data + layout.filter, blocklist.filter, (size_t)blocklist.filter_blocks * BLOOM_BLOCK_SIZE);
+    }
+    memcpy(data + layout.nodes, blocklist.nodes, (size_t)blocklist.nnodes * BLOCKLIST_NODE_SIZE);
+    memcpy(data + layout.labels, blocklist.labels, blocklist.labels_len);
+    image_record_t* records = (image_record_t*)(data + layout.records);
+    size_t names_len = 0;
+    for (int i = 0; i < hosts->nrecords; ++i) {
+        const hosts_record_t* record = &hosts->records[i];
+        size_t len = strlen(record->name) + 1;
+        records[i].name = (uint32_t)names_len;
+        memcpy(data + layout.names + names_len, record->name, len);
+        names_len += len;
+        records[i].target = IMAGE_NO_TARGET;
+        if (record->target != NULL) {
+            len = strlen(record->target) + 1;
+            records[i].target = (uint32_t)names_len;
+            memcpy(data + layout.names + names_len, record->target, len);
+            names_len += len;
+        }
+        records[i].type = record->type;
+        memcpy(records[i].addr, record->addr, 16);
+    }
+    size_t body = IMAGE_ALIGN(sizeof(image_header_t));
+    header.checksum = image_checksum(data + body, layout.size - body);
+    memcpy(data, &header, sizeof(header));
+
+    char tmpname[1024];
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    FILE* file = fopen(tmpname, "wb");
+    if (file == NULL) {
+        free(data);
+        return -1;
+    }
+    fwrite(data, 1, layout.size, file);
+    free(data);
+    if (ferror(file) | fclose(file)) {
+        remove(tmpname);
+        return -1;
+    }
+#ifdef OS_WIN
+    remove(filename);
+#endif
+    if (rename(tmpname, filename) != 0) {
+        remove(tmpname);
+        return -1;
+    }
+    return 0;
+}
+
+// 校验镜像并填充 hosts，失败时返回-1
+static int load_image(const char* data, size_t size, hosts_t* hosts) {
+    image_header_t header;
+    if (size < IMAGE_ALIGN(sizeof(header))) {
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0) {
+        return -1;
+    }
+    if (header.version != RULES_IMAGE_VERSION || header.byte_order != IMAGE_BYTE_ORDER) {
+        hloge("Unsupported rules image version %u, recompile it with dns_relay_compile", header.version);
+        return -1;
+    }
+    image_layout_t layout;
+    get_layout(&header, &layout);
+    if (header.size != size || layout.size != size) {
+        hloge("Truncated rules image: %zu of %llu bytes", size, (unsigned long long)header.size);
+        return -1;
+    }
+    size_t body = IMAGE_ALIGN(sizeof(header));
+    if (image_checksum(data + body, size - body) != header.checksum) {
+        hloge("Rules image checksum mismatch");
+        return -1;
+    }
+
+    const char* names = data + layout.names;
+    if (header.names_len > 0 && names[header.names_len - 1] != '\0') {
+        return -1;
+    }
+    blocklist_image_t blocklist;
+    blocklist.nodes = data + layout.nodes;
+    blocklist.nnodes = header.nnodes;
+    blocklist.labels = data + layout.labels;
+    blocklist.labels_len = header.labels_len;
+    blocklist.count = header.count;
+    blocklist.filter = data + layout.filter;
+    blocklist.filter_blocks = header.filter_blocks;
+    blocklist.filter_k = header.filter_k;
+    hosts->blacklist = blocklist_import(&blocklist);
+    if (hosts->blacklist == NULL) {
+        return -1;
+    }
+
+    const image_record_t* records = (const image_record_t*)(data + layout.records);
+    hosts->records = (hosts_record_t*)malloc(sizeof(hosts_record_t) * (header.nrecords > 0 ? header.nrecords : 1));
+    if (hosts->records == NULL) {
+        hosts_free(hosts);
+        return -1;
+    }
+    for (uint32_t i = 0; i < header.nrecords; ++i) {
+        if (records[i].name >= header.names_len ||
+            (records[i].target != IMAGE_NO_TARGET && records[i].target >= header.names_len)) {
+            hosts_free(hosts);
+            return -1;
+        }
+        hosts_record_t* record = &hosts->records[i];
+        record->name = strdup(names + records[i].name);
+        record->target = records[i].target != IMAGE_NO_TARGET ? strdup(names + records[i].target) : NULL;
+        record->type = records[i].type;
+        memcpy(record->addr, records[i].addr, 16);
+        hosts->nrecords = (int)i + 1;
+    }
+    hosts->bytes = size;
+    return 0;
+}
+
+rules_image_t* rules_image_open(const char* filename, hosts_t* hosts) {
+    memset(hosts, 0, sizeof(hosts_t));
+    rules_image_t* image = (rules_image_t*)calloc(1, sizeof(rules_image_t));
+#ifdef OS_UNIX
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        free(image);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        free(image);
+        return NULL;
+    }
+    // 只读共享映射，多个进程映射同一镜像时共享物理页
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        free(image);
+        return NULL;
+    }
+    image->data = (char*)data;
+    image->size = st.st_size;
+#else
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        free(image);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    image->data = size > 0 ? (char*)malloc(size) : NULL;
+    image->size = size > 0 ? size : 0;
+    bool ok = image->data != NULL && fread(image->data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!ok) {
+        rules_image_close(image);
+        return NULL;
+    }
+#endif
+    if (load_image(image->data, image->size, hosts) != 0) {
+        hloge("Invalid rules image %s", filename);
+        rules_image_close(image);
+        return NULL;
+    }
+    return image;
+}
+
+void rules_image_close(rules_image_t* image) {
+    if (image == NULL) return;
+#ifdef OS_UNIX
+    munmap(image->data, image->size);
+#else
+    free(image->data);
+#endif
+    free(image);
+}